@@ -0,0 +1,593 @@
+#ifndef OSMIUM_HANDLER_EXTRACT_HPP
+#define OSMIUM_HANDLER_EXTRACT_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "IdBitmap.hpp"
+#include "OutputPBF.hpp"
+#include "OutputXML.hpp"
+
+namespace Osmium {
+
+    namespace Handler {
+
+        /**
+        * Cut extracts for any number of regions (bounding boxes or
+        * polygons) from the input in one go. Each extract is written to
+        * its own file, in PBF format if the file name ends in ".pbf",
+        * otherwise as OSM XML (gzipped if the name ends in ".gz").
+        *
+        * An extract contains all nodes inside the region, all ways with
+        * at least one node in the extract and all relations with at
+        * least one member in the extract. Which objects are in an extract
+        * is tracked with id bitmaps, so the input must be sorted (nodes,
+        * then ways, then relations).
+        *
+        * With complete_ways set, all nodes of the ways in an extract are
+        * written, too, so the ways are complete. This needs two passes
+        * over the input (see passes()): the first one only finds the
+        * objects, the second one writes them. The caller has to run the
+        * same callbacks once for each pass.
+        *
+        * Objects with negative ids (from editors) are not tracked.
+        */
+        class Extract : public Base {
+
+          public:
+
+            /**
+            * Area an extract is cut from. The bounding box is checked
+            * before contains() is called.
+            */
+            class Region {
+
+              protected:
+
+                double minlon, minlat, maxlon, maxlat;
+
+                Region() : minlon(180), minlat(90), maxlon(-180), maxlat(-90) {
+                }
+
+              public:
+
+                virtual ~Region() {
+                }
+
+                double get_minlon() const { return minlon; }
+                double get_minlat() const { return minlat; }
+                double get_maxlon() const { return maxlon; }
+                double get_maxlat() const { return maxlat; }
+
+                bool in_bbox(double lon, double lat) const {
+                    return lon >= minlon && lon <= maxlon && lat >= minlat && lat <= maxlat;
+                }
+
+                /**
+                * Called once when the region is added to the handler,
+                * the region doesn't change after that. Regions can build
+                * lookup structures here.
+                */
+                virtual void prepare() {
+                }
+
+                /// is the location (which is known to be inside the bbox) inside the region?
+                virtual bool contains(double lon, double lat) const = 0;
+
+            }; // class Region
+
+            class Bbox : public Region {
+
+              public:
+
+                Bbox(double left, double bottom, double right, double top) : Region() {
+                    minlon = left;
+                    minlat = bottom;
+                    maxlon = right;
+                    maxlat = top;
+                }
+
+                bool contains(double /*lon*/, double /*lat*/) const {
+                    return true;
+                }
+
+            }; // class Bbox
+
+            /**
+            * Region made of one or more polygon rings. A location is in
+            * the region if it is inside an odd number of rings, so inner
+            * rings cut holes into outer rings.
+            *
+            * prepare() lays a grid of grid_size x grid_size cells over the
+            * bounding box. Cells no ring goes through are entirely inside
+            * or outside, so for most locations one lookup is enough. Only
+            * in the boundary cells the exact test is done, and that only
+            * looks at the segments crossing the grid row of the location.
+            */
+            class Polygon : public Region {
+
+              protected:
+
+                static const int grid_size = 256;
+
+                enum cell_t {
+                    cell_outside  = 0,
+                    cell_inside   = 1,
+                    cell_boundary = 2
+                };
+
+                struct Segment {
+                    double lon1, lat1, lon2, lat2;
+                };
+
+                std::vector<Segment> segments;
+
+                /// state of each cell, row by row (empty until prepare() is called)
+                std::vector<unsigned char> cells;
+
+                /// indexes into segments of the segments crossing each grid row
+                std::vector<std::vector<unsigned int> > row_segments;
+
+                int column(double lon) const {
+                    const int c = (lon - minlon) * grid_size / (maxlon - minlon);
+                    return c < 0 ? 0 : (c >= grid_size ? grid_size - 1 : c);
+                }
+
+                int row(double lat) const {
+                    const int r = (lat - minlat) * grid_size / (maxlat - minlat);
+                    return r < 0 ? 0 : (r >= grid_size ? grid_size - 1 : r);
+                }
+
+                /// longitude where the segment crosses the latitude
+                static double crossing(const Segment &s, double lat) {
+                    return s.lon1 + (lat - s.lat1) * (s.lon2 - s.lon1) / (s.lat2 - s.lat1);
+                }
+
+                /// does a ray from the location to the east cross the segment?
+                static bool ray_crosses(const Segment &s, double lon, double lat) {
+                    return (s.lat1 > lat) != (s.lat2 > lat) && lon < crossing(s, lat);
+                }
+
+                /// ray casting over the segments crossing one grid row
+                bool contains_in_row(int r, double lon, double lat) const {
+                    bool inside = false;
+                    for (std::vector<unsigned int>::const_iterator it = row_segments[r].begin(); it != row_segments[r].end(); it++) {
+                        if (ray_crosses(segments[*it], lon, lat)) {
+                            inside = !inside;
+                        }
+                    }
+                    return inside;
+                }
+
+              public:
+
+                Polygon() : Region(), segments(), cells(), row_segments() {
+                }
+
+                /**
+                * Read polygon file in the format used by osmosis (see
+                * http://wiki.openstreetmap.org/wiki/Osmosis/Polygon_Filter_File_Format).
+                */
+                Polygon(const char *filename) : Region(), segments(), cells(), row_segments() {
+                    FILE *file = fopen(filename, "r");
+                    if (!file) {
+                        throw std::runtime_error(std::string("can't open polygon file '") + filename + "': " + strerror(errno));
+                    }
+
+                    char line[256];
+                    std::vector<std::pair<double, double> > ring;
+                    bool in_ring = false;
+                    bool ok = false;
+
+                    // the first line is the name of the polygon
+                    if (fgets(line, sizeof(line), file)) {
+                        while (fgets(line, sizeof(line), file)) {
+                            char word[256];
+                            if (sscanf(line, "%255s", word) != 1) {
+                                continue;
+                            }
+                            if (!strcmp(word, "END")) {
+                                if (!in_ring) {
+                                    ok = true;
+                                    break;
+                                }
+                                add_ring(ring);
+                                ring.clear();
+                                in_ring = false;
+                            } else if (!in_ring) {
+                                in_ring = true; // line with the name of the ring
+                            } else {
+                                double lon, lat;
+                                if (sscanf(line, "%lf %lf", &lon, &lat) != 2) {
+                                    break;
+                                }
+                                ring.push_back(std::make_pair(lon, lat));
+                            }
+                        }
+                    }
+                    fclose(file);
+
+                    if (!ok || segments.empty()) {
+                        throw std::runtime_error(std::string("invalid polygon file '") + filename + "'");
+                    }
+                }
+
+                /// add a ring, it is closed automatically if the last point isn't the same as the first
+                void add_ring(const std::vector<std::pair<double, double> > &ring) {
+                    const unsigned int n = ring.size();
+                    if (n < 3) {
+                        return;
+                    }
+                    for (unsigned int i=0; i < n; i++) {
+                        const unsigned int j = (i + 1) % n;
+                        if (ring[i] == ring[j]) {
+                            continue;
+                        }
+                        Segment s = { ring[i].first, ring[i].second, ring[j].first, ring[j].second };
+                        segments.push_back(s);
+                        if (ring[i].first  < minlon) minlon = ring[i].first;
+                        if (ring[i].first  > maxlon) maxlon = ring[i].first;
+                        if (ring[i].second < minlat) minlat = ring[i].second;
+                        if (ring[i].second > maxlat) maxlat = ring[i].second;
+                    }
+                }
+
+                void prepare() {
+                    if (segments.empty() || minlon >= maxlon || minlat >= maxlat) {
+                        return;
+                    }
+                    cells.assign(grid_size * grid_size, cell_outside);
+                    row_segments.assign(grid_size, std::vector<unsigned int>());
+
+                    const double cell_height = (maxlat - minlat) / grid_size;
+                    for (unsigned int i=0; i < segments.size(); i++) {
+                        const Segment &s = segments[i];
+                        const double lat_low  = std::min(s.lat1, s.lat2);
+                        const double lat_high = std::max(s.lat1, s.lat2);
+                        for (int r = row(lat_low); r <= row(lat_high); r++) {
+                            row_segments[r].push_back(i);
+
+                            // part of the segment inside this row, the cells
+                            // it goes through (and one more on each side to
+                            // be safe from rounding) are boundary cells
+                            double lon_low, lon_high;
+                            if (s.lat1 == s.lat2) {
+                                lon_low  = std::min(s.lon1, s.lon2);
+                                lon_high = std::max(s.lon1, s.lon2);
+                            } else {
+                                const double lon_a = crossing(s, std::max(lat_low,  minlat + r * cell_height));
+                                const double lon_b = crossing(s, std::min(lat_high, minlat + (r + 1) * cell_height));
+                                lon_low  = std::min(lon_a, lon_b);
+                                lon_high = std::max(lon_a, lon_b);
+                            }
+                            const int c_end = std::min(column(lon_high) + 1, grid_size - 1);
+                            for (int c = std::max(column(lon_low) - 1, 0); c <= c_end; c++) {
+                                cells[r * grid_size + c] = cell_boundary;
+                            }
+                        }
+                    }
+
+                    // no ring goes through the other cells, so the center
+                    // tells whether the whole cell is inside
+                    const double cell_width = (maxlon - minlon) / grid_size;
+                    for (int r=0; r < grid_size; r++) {
+                        const double lat = minlat + (r + 0.5) * cell_height;
+                        for (int c=0; c < grid_size; c++) {
+                            if (cells[r * grid_size + c] != cell_boundary && contains_in_row(r, minlon + (c + 0.5) * cell_width, lat)) {
+                                cells[r * grid_size + c] = cell_inside;
+                            }
+                        }
+                    }
+                }
+
+                bool contains(double lon, double lat) const {
+                    if (cells.empty()) {
+                        bool inside = false;
+                        for (std::vector<Segment>::const_iterator s = segments.begin(); s != segments.end(); s++) {
+                            if (ray_crosses(*s, lon, lat)) {
+                                inside = !inside;
+                            }
+                        }
+                        return inside;
+                    }
+                    const int r = row(lat);
+                    switch (cells[r * grid_size + column(lon)]) {
+                        case cell_outside:
+                            return false;
+                        case cell_inside:
+                            return true;
+                        default:
+                            return contains_in_row(r, lon, lat);
+                    }
+                }
+
+            }; // class Polygon
+
+          private:
+
+            /**
+            * The output handlers have no virtual methods, this wraps them
+            * so that extracts in different formats can be handled alike.
+            */
+            class Output {
+
+              public:
+
+                virtual ~Output() {
+                }
+
+                virtual void init() = 0;
+                virtual void node(OSM::Node *node) = 0;
+                virtual void way(OSM::Way *way) = 0;
+                virtual void relation(OSM::Relation *relation) = 0;
+                virtual void final() = 0;
+
+            }; // class Output
+
+            template <class T>
+            class OutputHandler : public Output {
+
+                T handler;
+
+              public:
+
+                OutputHandler(bool debug, const char *filename) : handler(debug, filename) {
+                }
+
+                void init() {
+                    handler.callback_init();
+                }
+
+                void node(OSM::Node *node) {
+                    handler.callback_node(node);
+                }
+
+                void way(OSM::Way *way) {
+                    handler.callback_way(way);
+                }
+
+                void relation(OSM::Relation *relation) {
+                    handler.callback_relation(relation);
+                }
+
+                void final() {
+                    handler.callback_final();
+                }
+
+            }; // class OutputHandler
+
+            struct Cut {
+                Region *region;
+                Output *output;
+                IdBitmap nodes;
+                IdBitmap ways;
+                IdBitmap relations;
+
+                /// nodes of the ways in the extract, only needed for complete_ways
+                IdBitmap way_nodes;
+
+                Cut(Region *region, Output *output) : region(region), output(output), nodes(), ways(), relations(), way_nodes() {
+                }
+
+                ~Cut() {
+                    delete output;
+                    delete region;
+                }
+            };
+
+            std::vector<Cut *> cuts;
+
+            /**
+            * Coarse index of the regions: for each 1 x 1 degree cell of
+            * the world the indexes into cuts of the regions whose bounding
+            * box overlaps the cell. So for each node only the few regions
+            * nearby are checked, however many extracts there are.
+            */
+            std::vector<std::vector<unsigned int> > region_index;
+
+            bool complete_ways;
+
+            /// the pass we are in, counting from 1
+            int pass;
+
+            Extract(const Extract &);
+            Extract &operator=(const Extract &);
+
+            bool writing() const {
+                return pass == passes();
+            }
+
+            /// cell of region_index (-1 for invalid locations)
+            static int index_cell(double lon, double lat) {
+                if (!(lon >= -180 && lon <= 180 && lat >= -90 && lat <= 90)) {
+                    return -1;
+                }
+                const int x = std::min(int(lon + 180), 359);
+                const int y = std::min(int(lat + 90), 179);
+                return y * 360 + x;
+            }
+
+            static bool member_in_cut(OSM::Relation *relation, const Cut *cut) {
+                for (osm_sequence_id_t i=0; i < relation->member_count(); i++) {
+                    const OSM::RelationMember *member = relation->get_member(i);
+                    if (member->ref < 0) {
+                        continue;
+                    }
+                    switch (member->type) {
+                        case 'n':
+                            if (cut->nodes.get(member->ref)) return true;
+                            break;
+                        case 'w':
+                            if (cut->ways.get(member->ref)) return true;
+                            break;
+                        case 'r':
+                            if (cut->relations.get(member->ref)) return true;
+                            break;
+                    }
+                }
+                return false;
+            }
+
+          public:
+
+            Extract(bool debug, bool complete_ways=false) : Base(debug), cuts(), region_index(360 * 180), complete_ways(complete_ways), pass(1) {
+            }
+
+            ~Extract() {
+                for (std::vector<Cut *>::iterator it = cuts.begin(); it != cuts.end(); it++) {
+                    delete *it;
+                }
+            }
+
+            /**
+            * Add an extract of the given region (which is deleted by the
+            * handler) written to the given file. Must be called before
+            * the first pass.
+            */
+            void add_extract(Region *region, const char *filename) {
+                const size_t length = strlen(filename);
+                Output *output;
+                if (length > 4 && !strcmp(filename + length - 4, ".pbf")) {
+                    output = new OutputHandler<Osmium::Output::PBF>(debug, filename);
+                } else {
+                    output = new OutputHandler<Osmium::Output::XML>(debug, filename);
+                }
+
+                region->prepare();
+                const int first = index_cell(std::max(region->get_minlon(), -180.0), std::max(region->get_minlat(), -90.0));
+                const int last  = index_cell(std::min(region->get_maxlon(),  180.0), std::min(region->get_maxlat(),  90.0));
+                if (first >= 0 && last >= 0) {
+                    for (int y = first / 360; y <= last / 360; y++) {
+                        for (int x = first % 360; x <= last % 360; x++) {
+                            region_index[y * 360 + x].push_back(cuts.size());
+                        }
+                    }
+                }
+
+                cuts.push_back(new Cut(region, output));
+            }
+
+            /// number of passes over the input needed
+            int passes() const {
+                return complete_ways ? 2 : 1;
+            }
+
+            void callback_init() {
+                if (writing()) {
+                    for (std::vector<Cut *>::iterator it = cuts.begin(); it != cuts.end(); it++) {
+                        (*it)->output->init();
+                    }
+                }
+            }
+
+            void callback_node(OSM::Node *node) {
+                const osm_object_id_t id = node->get_id();
+                if (id < 0) {
+                    return;
+                }
+
+                if (pass > 1) {
+                    for (std::vector<Cut *>::iterator it = cuts.begin(); it != cuts.end(); it++) {
+                        if ((*it)->nodes.get(id)) {
+                            (*it)->output->node(node);
+                        }
+                    }
+                    return;
+                }
+
+                const double lon = node->get_lon();
+                const double lat = node->get_lat();
+                const int cell = index_cell(lon, lat);
+                if (cell < 0) {
+                    return;
+                }
+                const std::vector<unsigned int> &candidates = region_index[cell];
+                for (std::vector<unsigned int>::const_iterator it = candidates.begin(); it != candidates.end(); it++) {
+                    Cut *cut = cuts[*it];
+                    if (cut->region->in_bbox(lon, lat) && cut->region->contains(lon, lat)) {
+                        cut->nodes.set(id);
+                        if (writing()) {
+                            cut->output->node(node);
+                        }
+                    }
+                }
+            }
+
+            void callback_way(OSM::Way *way) {
+                const osm_object_id_t id = way->get_id();
+                if (id < 0) {
+                    return;
+                }
+                for (std::vector<Cut *>::iterator it = cuts.begin(); it != cuts.end(); it++) {
+                    Cut *cut = *it;
+                    if (pass == 1) {
+                        for (osm_sequence_id_t i=0; i < way->node_count(); i++) {
+                            if (way->nodes[i] >= 0 && cut->nodes.get(way->nodes[i])) {
+                                cut->ways.set(id);
+                                break;
+                            }
+                        }
+                        if (complete_ways && cut->ways.get(id)) {
+                            for (osm_sequence_id_t i=0; i < way->node_count(); i++) {
+                                if (way->nodes[i] >= 0) {
+                                    cut->way_nodes.set(way->nodes[i]);
+                                }
+                            }
+                        }
+                    }
+                    if (writing() && cut->ways.get(id)) {
+                        cut->output->way(way);
+                    }
+                }
+            }
+
+            void callback_relation(OSM::Relation *relation) {
+                const osm_object_id_t id = relation->get_id();
+                if (id < 0 || !writing()) {
+                    return;
+                }
+                for (std::vector<Cut *>::iterator it = cuts.begin(); it != cuts.end(); it++) {
+                    Cut *cut = *it;
+                    if (member_in_cut(relation, cut)) {
+                        cut->relations.set(id);
+                        cut->output->relation(relation);
+                    }
+                }
+            }
+
+            /**
+            * At the end of the first of two passes the nodes of the ways
+            * are added to the extracts, at the end of the last pass the
+            * files are finished.
+            */
+            void callback_final() {
+                for (std::vector<Cut *>::iterator it = cuts.begin(); it != cuts.end(); it++) {
+                    Cut *cut = *it;
+                    if (writing()) {
+                        cut->output->final();
+                    } else {
+                        cut->nodes.merge(cut->way_nodes);
+                        cut->way_nodes.clear();
+                    }
+                    if (debug) {
+                        std::cerr << "extract " << (it - cuts.begin()) << " pass " << pass << ": "
+                                  << cut->nodes.count() << " nodes, "
+                                  << cut->ways.count() << " ways, "
+                                  << cut->relations.count() << " relations" << std::endl;
+                    }
+                }
+                pass++;
+            }
+
+        }; // class Extract
+
+    } // namespace Handler
+
+} // namespace Osmium
+
+#endif // OSMIUM_HANDLER_EXTRACT_HPP
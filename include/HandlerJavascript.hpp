@@ -4,6 +4,7 @@
 #include <fstream>
 
 #include "Javascript.hpp"
+#include "TagFilter.hpp"
 
 extern v8::Persistent<v8::Context> global_context;
 
@@ -75,8 +76,63 @@ namespace Osmium {
                 v8::Handle<v8::Function> relation;
                 v8::Handle<v8::Function> multipolygon;
                 v8::Handle<v8::Function> end;
+
+                // filters set in the scripts, checked before the callbacks are called
+                TagFilter object_filter;
+                TagFilter node_filter;
+                TagFilter way_filter;
+                TagFilter relation_filter;
+                TagFilter multipolygon_filter;
             } cb;
 
+            /**
+            * Read the 'filter' property of a callback function (if there
+            * is one) into the tag filter. The filter is an object with
+            * tag keys as properties, the values are true (for any value),
+            * a string or an array of strings.
+            */
+            void read_filter(v8::Handle<v8::Function> callback, const char *name, TagFilter &filter) {
+                if (callback.IsEmpty()) {
+                    return;
+                }
+                v8::Handle<v8::Value> filter_value = callback->Get(v8::String::New("filter"));
+                if (filter_value->IsUndefined()) {
+                    return;
+                }
+                if (!filter_value->IsObject() || filter_value->IsArray() || filter_value->IsFunction()) {
+                    std::cerr << "Osmium.Callbacks." << name << ".filter must be an object" << std::endl;
+                    exit(1);
+                }
+
+                v8::Handle<v8::Object> filter_object = filter_value->ToObject();
+                v8::Handle<v8::Array> keys = filter_object->GetPropertyNames();
+                filter.enable();
+                for (uint32_t i=0; i < keys->Length(); i++) {
+                    v8::Handle<v8::Value> key = keys->Get(i);
+                    v8::String::Utf8Value key_str(key);
+                    v8::Handle<v8::Value> value = filter_object->Get(key);
+                    if (value->IsTrue()) {
+                        filter.add_key(*key_str);
+                    } else if (value->IsString()) {
+                        v8::String::Utf8Value value_str(value);
+                        filter.add_tag(*key_str, *value_str);
+                    } else if (value->IsArray()) {
+                        v8::Handle<v8::Array> values = v8::Handle<v8::Array>::Cast(value);
+                        for (uint32_t j=0; j < values->Length(); j++) {
+                            v8::String::Utf8Value value_str(values->Get(j));
+                            filter.add_tag(*key_str, *value_str);
+                        }
+                    } else {
+                        std::cerr << "Osmium.Callbacks." << name << ".filter." << *key_str << " must be true, a string or an array of strings" << std::endl;
+                        exit(1);
+                    }
+                }
+
+                if (debug) {
+                    std::cerr << "filter for " << name << " callback with " << keys->Length() << " keys" << std::endl;
+                }
+            }
+
           public:
 
             static v8::Handle<v8::Value> Print(const v8::Arguments& args) {
@@ -234,6 +290,13 @@ namespace Osmium {
                 if (cc->IsFunction()) {
                     cb.end = v8::Handle<v8::Function>::Cast(cc);
                 }
+
+                read_filter(cb.object,       "object",       cb.object_filter);
+                read_filter(cb.node,         "node",         cb.node_filter);
+                read_filter(cb.way,          "way",          cb.way_filter);
+                read_filter(cb.relation,     "relation",     cb.relation_filter);
+                read_filter(cb.multipolygon, "multipolygon", cb.multipolygon_filter);
+
                 wrap_multipolygon = new Osmium::Javascript::Multipolygon::Wrapper;
             }
 
@@ -249,35 +312,35 @@ namespace Osmium {
             }
 
             void callback_object(OSM::Object *object) {
-                if (!cb.object.IsEmpty()) {
+                if (!cb.object.IsEmpty() && cb.object_filter.match(object)) {
                     Osmium::Javascript::Object::Wrapper *wrapper = (Osmium::Javascript::Object::Wrapper *) object->wrapper;
                     (void) cb.object->Call(wrapper->get_instance(), 0, 0);
                 }
             }
 
             void callback_node(OSM::Node *object) {
-                if (!cb.node.IsEmpty()) {
+                if (!cb.node.IsEmpty() && cb.node_filter.match(object)) {
                     Osmium::Javascript::Node::Wrapper *wrapper = (Osmium::Javascript::Node::Wrapper *) object->wrapper;
                     (void) cb.node->Call(wrapper->get_instance(), 0, 0);
                 }
             }
 
             void callback_way(OSM::Way *object) {
-                if (!cb.way.IsEmpty()) {
+                if (!cb.way.IsEmpty() && cb.way_filter.match(object)) {
                     Osmium::Javascript::Way::Wrapper *wrapper = (Osmium::Javascript::Way::Wrapper *) object->wrapper;
                     (void) cb.way->Call(wrapper->get_instance(), 0, 0);
                 }
             }
 
             void callback_relation(OSM::Relation *object) {
-                if (!cb.relation.IsEmpty()) {
+                if (!cb.relation.IsEmpty() && cb.relation_filter.match(object)) {
                     Osmium::Javascript::Relation::Wrapper *wrapper = (Osmium::Javascript::Relation::Wrapper *) object->wrapper;
                     (void) cb.relation->Call(wrapper->get_instance(), 0, 0);
                 }
             }
 
             void callback_multipolygon(OSM::Multipolygon *object) {
-                if (!cb.multipolygon.IsEmpty()) {
+                if (!cb.multipolygon.IsEmpty() && cb.multipolygon_filter.match(object)) {
                     wrap_multipolygon->set_object(object);
                     (void) cb.multipolygon->Call(wrap_multipolygon->get_instance(), 0, 0);
                 }
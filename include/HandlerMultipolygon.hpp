@@ -1,7 +1,13 @@
 #ifndef OSMIUM_HANDLER_MULTIPOLYGON_HPP
 #define OSMIUM_HANDLER_MULTIPOLYGON_HPP
 
-#include <google/sparse_hash_map>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <cstdio>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 namespace Osmium {
 
@@ -12,20 +18,324 @@ namespace Osmium {
             /// a list of multipolygons that need to be completed
             std::vector<Osmium::OSM::MultipolygonFromRelation *> multipolygons;
 
-            // a map from way_id to a vector of indexes into the multipolygons array
-            // this is used to find in which multipolygon relations a way is
-            typedef google::sparse_hash_map<osm_object_id_t, std::vector<osm_object_id_t> > way2mpidx_t;
-            way2mpidx_t way2mpidx;
+            /// (way id, index into the multipolygons array) for each member way
+            typedef std::pair<osm_object_id_t, osm_object_id_t> way2mpidx_t;
+
+            // Pairs of way ids and indexes into the multipolygons array, this
+            // is used to find in which multipolygon relations a way is. It is
+            // filled in pass 1 and sorted by way id at the end of pass 1. Ways
+            // come sorted by id in pass 2, so we just walk along the vector.
+            std::vector<way2mpidx_t> way2mpidx;
+
+            /// position in way2mpidx of the first entry for the next way in pass 2
+            std::vector<way2mpidx_t>::const_iterator way2mpidx_pos;
 
             bool attempt_repair;
             struct callbacks *cb;
 
             uint64_t count_ways_in_all_multipolygons;
 
+            /// reused for all closed ways that are not in a multipolygon relation
+            Osmium::OSM::MultipolygonFromWay *simple_area;
+
+            /// build statistics of all multipolygon relations, NULL unless enable_profiling() was called
+            Osmium::OSM::MultipolygonProfile *profile;
+
+            /// worker threads building the geometries of complete multipolygons
+            std::vector<std::thread> workers;
+
+            /// maximum number of complete multipolygons waiting for a worker
+            unsigned int max_queue_size;
+
+            std::mutex queue_mutex;
+            std::condition_variable queue_not_empty;
+            std::condition_variable queue_not_full;
+            std::condition_variable result_available;
+
+            /// complete multipolygons waiting for a worker (protected by queue_mutex)
+            std::deque<Osmium::OSM::MultipolygonFromRelation *> todo;
+
+            /// multipolygons with geometry waiting to be handed to the callback (protected by queue_mutex)
+            std::deque<Osmium::OSM::MultipolygonFromRelation *> done;
+
+            /// number of multipolygons queued or being built right now (protected by queue_mutex)
+            int in_progress;
+
+            /// tells workers to stop when the queue is empty (protected by queue_mutex)
+            bool shutdown;
+
+            /// memory budget for the member ways of pending multipolygons (0 = unlimited)
+            uint64_t memory_budget;
+
+            /// approximate memory used by the member ways of pending multipolygons
+            uint64_t pending_memory;
+
+            /**
+            * Temporary file for the member ways of multipolygons spilled to
+            * disk because the memory budget was exceeded. Each record is the
+            * index into multipolygons followed by the member way.
+            */
+            FILE *spill_file;
+
+            /// map from index into multipolygons to approximate size of its spilled member ways
+            std::map<osm_object_id_t, uint64_t> spilled;
+
+            void spill_member_way(osm_object_id_t mp_index, Osmium::OSM::MemberWay *member_way) {
+                if (!spill_file) {
+                    spill_file = tmpfile();
+                    if (!spill_file) {
+                        throw std::runtime_error("can not create temporary file for spilling multipolygons");
+                    }
+                }
+                const uint32_t index = mp_index;
+                if (fwrite(&index, sizeof(index), 1, spill_file) != 1) {
+                    throw std::runtime_error("can not write to spill file");
+                }
+                member_way->write(spill_file);
+                spilled[mp_index] += member_way->memory_usage();
+                delete member_way;
+            }
+
+            /// Move the member ways of a pending multipolygon to the spill file.
+            void spill(osm_object_id_t mp_index) {
+                std::vector<Osmium::OSM::MemberWay *> member_ways = multipolygons[mp_index]->release_member_ways();
+                spilled[mp_index] += 0; // mark as spilled even if there are no member ways yet
+                for (std::vector<Osmium::OSM::MemberWay *>::iterator it = member_ways.begin(); it != member_ways.end(); it++) {
+                    pending_memory -= (*it)->memory_usage();
+                    spill_member_way(mp_index, *it);
+                }
+            }
+
+            /**
+            * Called when the pending member ways need more memory than the
+            * budget allows. Spills the pending multipolygons using the most
+            * memory until we are at three quarters of the budget, so that
+            * we don't have to look for the next one to spill on every way.
+            */
+            void spill_largest() {
+                std::vector<std::pair<uint64_t, osm_object_id_t> > candidates;
+                for (unsigned int i=0; i < multipolygons.size(); i++) {
+                    if (multipolygons[i] && spilled.find(i) == spilled.end()) {
+                        const uint64_t size = multipolygons[i]->member_ways_memory_usage();
+                        if (size) {
+                            candidates.push_back(std::make_pair(size, i));
+                        }
+                    }
+                }
+                std::sort(candidates.begin(), candidates.end());
+
+                const uint64_t target = memory_budget - memory_budget / 4;
+                while (pending_memory > target && !candidates.empty()) {
+                    spill(candidates.back().second);
+                    candidates.pop_back();
+                }
+            }
+
+            /**
+            * Complete the spilled multipolygons after all ways have been
+            * read. They are done in batches that fit into the memory budget,
+            * for each batch the spill file is read once.
+            */
+            void complete_spilled() {
+                if (spilled.empty()) {
+                    return;
+                }
+
+                if (debug) {
+                    std::cerr << "completing " << spilled.size() << " multipolygons spilled to disk" << std::endl;
+                }
+
+                if (fflush(spill_file) != 0) {
+                    throw std::runtime_error("can not write to spill file");
+                }
+
+                std::map<osm_object_id_t, uint64_t>::const_iterator batch_begin = spilled.begin();
+                while (batch_begin != spilled.end()) {
+                    std::map<osm_object_id_t, uint64_t>::const_iterator batch_end = batch_begin;
+                    uint64_t batch_size = 0;
+                    do {
+                        batch_size += batch_end->second;
+                        batch_end++;
+                    } while (batch_end != spilled.end() && batch_size + batch_end->second <= memory_budget);
+
+                    rewind(spill_file);
+                    uint32_t index;
+                    while (fread(&index, sizeof(index), 1, spill_file) == 1) {
+                        Osmium::OSM::MemberWay *member_way = Osmium::OSM::MemberWay::read(spill_file);
+                        if (!member_way) {
+                            throw std::runtime_error("spill file is truncated");
+                        }
+                        if (index >= (uint32_t) batch_begin->first && (batch_end == spilled.end() || index < (uint32_t) batch_end->first)) {
+                            multipolygons[index]->add_member_way(member_way);
+                        } else {
+                            delete member_way;
+                        }
+                    }
+
+                    for (std::map<osm_object_id_t, uint64_t>::const_iterator it = batch_begin; it != batch_end; it++) {
+                        Osmium::OSM::MultipolygonFromRelation *mp = multipolygons[it->first];
+                        if (mp->is_complete()) {
+                            multipolygons[it->first] = NULL;
+                            submit(mp);
+                        } else {
+                            // some member ways are not in the input, this multipolygon
+                            // will never be complete, so we don't need its ways any more
+                            std::vector<Osmium::OSM::MemberWay *> member_ways = mp->release_member_ways();
+                            for (std::vector<Osmium::OSM::MemberWay *>::iterator mw = member_ways.begin(); mw != member_ways.end(); mw++) {
+                                delete *mw;
+                            }
+                        }
+                    }
+                    wait_for_workers();
+
+                    batch_begin = batch_end;
+                }
+
+                spilled.clear();
+                fclose(spill_file);
+                spill_file = NULL;
+            }
+
+            void worker() {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                while (true) {
+                    while (todo.empty() && !shutdown) {
+                        queue_not_empty.wait(lock);
+                    }
+                    if (todo.empty()) {
+                        return;
+                    }
+
+                    Osmium::OSM::MultipolygonFromRelation *mp = todo.front();
+                    todo.pop_front();
+                    queue_not_full.notify_one();
+
+                    lock.unlock();
+                    mp->build();
+                    lock.lock();
+
+                    done.push_back(mp);
+                    in_progress--;
+                    result_available.notify_one();
+                }
+            }
+
+            /**
+            * Hand all multipolygons built by the workers to the callback.
+            * Must be called from the main thread with the lock held, the
+            * lock is released while the callbacks run.
+            */
+            void deliver_done(std::unique_lock<std::mutex> &lock) {
+                while (!done.empty()) {
+                    std::deque<Osmium::OSM::MultipolygonFromRelation *> ready;
+                    ready.swap(done);
+                    lock.unlock();
+                    for (std::deque<Osmium::OSM::MultipolygonFromRelation *>::iterator it = ready.begin(); it != ready.end(); it++) {
+                        (*it)->handle_complete_multipolygon(debug);
+                        delete *it;
+                    }
+                    lock.lock();
+                }
+            }
+
+            /**
+            * Queue complete multipolygon for building by a worker. Blocks
+            * if the queue is full. Without workers the multipolygon is
+            * built and handed to the callback right away.
+            */
+            void submit(Osmium::OSM::MultipolygonFromRelation *mp) {
+                if (workers.empty()) {
+                    mp->handle_complete_multipolygon(debug);
+                    delete mp;
+                    return;
+                }
+
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                while (todo.size() >= max_queue_size) {
+                    deliver_done(lock);
+                    if (todo.size() >= max_queue_size) {
+                        queue_not_full.wait(lock);
+                    }
+                }
+                todo.push_back(mp);
+                in_progress++;
+                queue_not_empty.notify_one();
+
+                deliver_done(lock);
+            }
+
+            /// Wait until all queued multipolygons are built and handed to the callback.
+            void wait_for_workers() {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                while (in_progress > 0 || !done.empty()) {
+                    if (done.empty()) {
+                        result_available.wait(lock);
+                    }
+                    deliver_done(lock);
+                }
+            }
+
+            void stop_workers() {
+                {
+                    std::lock_guard<std::mutex> lock(queue_mutex);
+                    shutdown = true;
+                }
+                queue_not_empty.notify_all();
+                for (std::vector<std::thread>::iterator it = workers.begin(); it != workers.end(); it++) {
+                    it->join();
+                }
+                workers.clear();
+            }
+
           public:
 
-            Multipolygon(bool debug, bool attempt_repair, struct callbacks *cb) : Base(debug), attempt_repair(attempt_repair), cb(cb) {
+            /**
+            * Geometries of complete multipolygons are built by num_workers
+            * worker threads, the results are handed to the multipolygon
+            * callback in the thread calling callback_way() (or
+            * callback_after_ways()). With num_workers == 0 everything
+            * happens in callback_way().
+            *
+            * If the member ways of incomplete multipolygons need more than
+            * memory_budget bytes, multipolygons are spilled to a temporary
+            * file and completed in callback_after_ways(). With
+            * memory_budget == 0 everything is kept in memory.
+            */
+            Multipolygon(bool debug, bool attempt_repair, struct callbacks *cb, int num_workers=0, uint64_t memory_budget=0) : Base(debug), attempt_repair(attempt_repair), cb(cb), memory_budget(memory_budget) {
                 count_ways_in_all_multipolygons = 0;
+                max_queue_size = 4 * num_workers;
+                in_progress = 0;
+                shutdown = false;
+                pending_memory = 0;
+                spill_file = NULL;
+                simple_area = new Osmium::OSM::MultipolygonFromWay();
+                profile = NULL;
+                way2mpidx_pos = way2mpidx.begin();
+                for (int i=0; i < num_workers; i++) {
+                    workers.push_back(std::thread(&Multipolygon::worker, this));
+                }
+            }
+
+            ~Multipolygon() {
+                wait_for_workers();
+                stop_workers();
+                if (spill_file) {
+                    fclose(spill_file);
+                }
+                delete simple_area;
+                delete profile;
+            }
+
+            /**
+            * Record how long building each multipolygon relation takes.
+            * The totals, a histogram of the build times and the slowest
+            * relations are printed to stderr in callback_final(). Must be
+            * called before the first relation is seen.
+            */
+            void enable_profiling(unsigned int num_slowest=20) {
+                if (!profile) {
+                    profile = new Osmium::OSM::MultipolygonProfile(num_slowest);
+                }
             }
 
             // in pass 1
@@ -48,7 +358,7 @@ namespace Osmium {
                 for (int i=0; i < relation->member_count(); i++) {
                     Osmium::OSM::RelationMember *member = relation->get_member(i);
                     if (member->type == 'w') {
-                        way2mpidx[member->ref].push_back(multipolygons.size());
+                        way2mpidx.push_back(way2mpidx_t(member->ref, multipolygons.size()));
                         num_ways++;
                     } else {
                         std::cerr << "warning: multipolygon/boundary relation " << relation->get_id() << " has a non-way member which was ignored" << std::endl;
@@ -57,49 +367,80 @@ namespace Osmium {
 
                 count_ways_in_all_multipolygons += num_ways;
 
-                Osmium::OSM::MultipolygonFromRelation *mp = new Osmium::OSM::MultipolygonFromRelation(r, is_boundary, num_ways, cb->multipolygon, attempt_repair);
+                Osmium::OSM::MultipolygonFromRelation *mp = new Osmium::OSM::MultipolygonFromRelation(r, is_boundary, num_ways, cb->multipolygon, attempt_repair, profile);
                 multipolygons.push_back(mp);
             }
 
             // in pass 1
             void callback_after_relations() {
+                std::sort(way2mpidx.begin(), way2mpidx.end());
+                way2mpidx.shrink_to_fit();
+                way2mpidx_pos = way2mpidx.begin();
+
                 if (debug) {
                     std::cerr << "found " << multipolygons.size() << " multipolygons (each needs " << sizeof(Osmium::OSM::Multipolygon) << " bytes, thats together about " << sizeof(Osmium::OSM::Multipolygon) * multipolygons.size() / (1024 * 1024) << "MB)" << std::endl;
-                    std::cerr << "they used " << count_ways_in_all_multipolygons << " ways (each will need " << sizeof(Osmium::OSM::Way) << " bytes, thats in the worst case together about " << sizeof(Osmium::OSM::Way) * count_ways_in_all_multipolygons / (1024 * 1024) << "MB)" << std::endl;
+                    std::cerr << "they used " << count_ways_in_all_multipolygons << " ways (each will need " << sizeof(Osmium::OSM::MemberWay) << " bytes plus " << 2 * sizeof(int32_t) << " bytes per node, thats together about " << sizeof(Osmium::OSM::MemberWay) * count_ways_in_all_multipolygons / (1024 * 1024) << "MB plus the nodes; tagged closed ways are copied completely)" << std::endl;
                 }
             }
 
             // in pass 2
             void callback_way(OSM::Way *way) {
-                way2mpidx_t::iterator way2mpidx_iterator = way2mpidx.find(way->get_id());
+                const osm_object_id_t id = way->get_id();
 
-                if (way2mpidx_iterator == way2mpidx.end()) { // not in any relation
+                // ways should come sorted by id, if not we have to search
+                if (way2mpidx_pos != way2mpidx.begin() && (way2mpidx_pos - 1)->first >= id) {
+                    way2mpidx_pos = std::lower_bound(way2mpidx.begin(), way2mpidx.end(), way2mpidx_t(id, 0));
+                }
+                while (way2mpidx_pos != way2mpidx.end() && way2mpidx_pos->first < id) {
+                    way2mpidx_pos++;
+                }
+
+                if (way2mpidx_pos == way2mpidx.end() || way2mpidx_pos->first != id) { // not in any relation
                     if (way->is_closed()) { // way is closed, build simple multipolygon
-                        Osmium::OSM::MultipolygonFromWay *mp = new Osmium::OSM::MultipolygonFromWay(way, way->create_geos_geometry());
-                        std::cerr << "MP simple way_id=" << way->get_id() << "\n";
-                        callback_multipolygon(mp);
-                        delete mp;
+                        simple_area->set_way(way);
+                        if (simple_area->normalize()) {
+                            if (debug) std::cerr << "MP simple way_id=" << way->get_id() << "\n";
+                            callback_multipolygon(simple_area);
+                        } else if (debug) {
+                            std::cerr << "MP simple way_id=" << way->get_id() << " is not a valid polygon\n";
+                        }
                     }
                     return;
                 }
                 
                 // is in at least one multipolygon relation
 
-                std::vector<osm_object_id_t> v = way2mpidx_iterator->second;
-                std::cerr << "MP way_id=" << way->get_id() << " is in " << v.size() << " multipolygons\n";
+                std::vector<way2mpidx_t>::const_iterator way2mpidx_end = way2mpidx_pos;
+                while (way2mpidx_end != way2mpidx.end() && way2mpidx_end->first == id) {
+                    way2mpidx_end++;
+                }
+                if (debug) std::cerr << "MP way_id=" << way->get_id() << " is in " << (way2mpidx_end - way2mpidx_pos) << " multipolygons\n";
 
                 // go through all the multipolygons this way is in
-                for (unsigned int i=0; i < v.size(); i++) {
-                    Osmium::OSM::MultipolygonFromRelation *mp = multipolygons[v[i]];
-                    std::cerr << "MP multi way_id=" << way->get_id() << " is in relation_id=" << mp->get_id() << "\n";
+                for (; way2mpidx_pos != way2mpidx_end; way2mpidx_pos++) {
+                    const osm_object_id_t mp_index = way2mpidx_pos->second;
+                    Osmium::OSM::MultipolygonFromRelation *mp = multipolygons[mp_index];
+                    if (!mp) { // already complete (way is in the relation twice)
+                        continue;
+                    }
+                    if (debug) std::cerr << "MP multi way_id=" << way->get_id() << " is in relation_id=" << mp->get_id() << "\n";
 
-                    // store copy of current way in multipolygon
-                    mp->add_member_way(way);
+                    if (!spilled.empty() && spilled.find(mp_index) != spilled.end()) {
+                        spill_member_way(mp_index, mp->create_member_way(way));
+                        continue;
+                    }
+
+                    // store geometry (and maybe a copy) of current way in multipolygon
+                    Osmium::OSM::MemberWay *member_way = mp->create_member_way(way);
+                    pending_memory += member_way->memory_usage();
+                    mp->add_member_way(member_way);
 
                     if (mp->is_complete()) {
-                        mp->handle_complete_multipolygon();
-                        multipolygons[v[i]] = NULL;
-                        delete mp;
+                        pending_memory -= mp->member_ways_memory_usage();
+                        multipolygons[mp_index] = NULL;
+                        submit(mp);
+                    } else if (memory_budget && pending_memory > memory_budget) {
+                        spill_largest();
                     }
                 }
             }
@@ -109,10 +450,19 @@ namespace Osmium {
                 cb->multipolygon(multipolygon);
             }
 
+            // in pass 2
+            void callback_after_ways() {
+                wait_for_workers();
+                complete_spilled();
+            }
+
             void callback_final() {
-#ifdef WITH_MULTIPOLYGON_PROFILING
-                Osmium::OSM::MultipolygonFromRelation::print_timings();
-#endif
+                wait_for_workers();
+                complete_spilled(); // in case callback_after_ways() wasn't called
+                stop_workers();
+                if (profile) {
+                    profile->print(std::cerr);
+                }
             }
 
         }; // class Multipolygon
@@ -1,10 +1,13 @@
 #ifndef OSMIUM_HANDLER_NODELOCATIONSTORE_HPP
 #define OSMIUM_HANDLER_NODELOCATIONSTORE_HPP
 
+#include <limits>
 #include <stdexcept>
 #include <google/sparsetable>
 #include <sys/mman.h>
 
+#include "IdBitmap.hpp"
+
 
 namespace Osmium {
 
@@ -18,6 +21,9 @@ namespace Osmium {
         * x and y coordinates, respectively. This gives you an
         * accuracy of a few centimeters, good enough for OSM
         * use.
+        *
+        * Way nodes whose location was never stored (because they are
+        * not in the input file) get NaN coordinates.
         */
         class NodeLocationStore : public Base {
 
@@ -42,6 +48,10 @@ namespace Osmium {
                 return ((double)c) / 10000000;
             }
 
+            static void set_missing_node_coordinates(OSM::Way *way, osm_sequence_id_t n) {
+                way->set_node_coordinates(n, std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::quiet_NaN());
+            }
+
         public:
 
             NodeLocationStore(bool debug) : Base(debug) {
@@ -63,17 +73,18 @@ namespace Osmium {
         * Use this node location store if you are working with large
         * OSM files (like the whole planet or substantial extracts).
         *
-        * Caution: The node store is not initialized to some zero value.
-        * You can not find out if a node coordinate was ever set!
+        * The array is not initialized, which ids were set is kept in a
+        * bitmap (one bit per node id).
         */
         class NLS_Array : public NodeLocationStore {
 
             int max_nodes;
             struct coordinates *coordinates;
+            IdBitmap stored;
 
         public:
 
-            NLS_Array(bool debug) : NodeLocationStore(debug) {
+            NLS_Array(bool debug) : NodeLocationStore(debug), stored() {
                 max_nodes = 1.2 * 1024 * 1024 * 1024; // XXX make configurable, or autosizing?
                 coordinates = (struct coordinates *) malloc(sizeof(struct coordinates) * max_nodes);
                 if (!coordinates) {
@@ -89,6 +100,7 @@ namespace Osmium {
                 const osm_object_id_t id = object->get_id() + NodeLocationStore::negative_id_offset;
                 coordinates[id].x = double_to_fix(object->get_lon());
                 coordinates[id].y = double_to_fix(object->get_lat());
+                stored.set(id);
             }
             
             void callback_after_nodes() {
@@ -101,7 +113,11 @@ namespace Osmium {
                 const osm_sequence_id_t num_nodes = object->node_count();
                 for (osm_sequence_id_t i=0; i < num_nodes; i++) {
                     osm_object_id_t node_id = object->nodes[i] + NodeLocationStore::negative_id_offset;
-                    object->set_node_coordinates(i, fix_to_double(coordinates[node_id].x), fix_to_double(coordinates[node_id].y));
+                    if (node_id >= 0 && stored.get(node_id)) {
+                        object->set_node_coordinates(i, fix_to_double(coordinates[node_id].x), fix_to_double(coordinates[node_id].y));
+                    } else {
+                        set_missing_node_coordinates(object, i);
+                    }
                 }
             }
 
@@ -150,8 +166,13 @@ namespace Osmium {
             void callback_way(OSM::Way *object) {
                 osm_sequence_id_t num_nodes = object->node_count();
                 for (osm_sequence_id_t i=0; i < num_nodes; i++) {
-                    struct coordinates c = nodes_table[object->nodes[i] + NodeLocationStore::negative_id_offset];
-                    object->set_node_coordinates(i, fix_to_double(c.x), fix_to_double(c.y));
+                    const osm_object_id_t id = object->nodes[i] + NodeLocationStore::negative_id_offset;
+                    if (id >= 0 && id < (osm_object_id_t)nodes_table.size() && nodes_table.test(id)) {
+                        const struct coordinates &c = nodes_table.get(id);
+                        object->set_node_coordinates(i, fix_to_double(c.x), fix_to_double(c.y));
+                    } else {
+                        set_missing_node_coordinates(object, i);
+                    }
                 }
             }
 
@@ -160,7 +181,7 @@ namespace Osmium {
         /**
         * The NLS_Disk node location store handler stores location
         * in a memory-mapped file on disk. The size of the file is 8 times 
-        * the largest node ID.
+        * the largest node ID. Which ids were set is kept in a bitmap.
         *
         * Use this node location store if the other types of storage lead
         * to memory problems.
@@ -169,10 +190,11 @@ namespace Osmium {
 
             int max_nodes;
             struct coordinates *coordinates;
+            IdBitmap stored;
 
         public:
 
-            NLS_Disk(bool debug) : NodeLocationStore(debug) {
+            NLS_Disk(bool debug) : NodeLocationStore(debug), stored() {
                 max_nodes = 1.2 * 1024 * 1024 * 1024; // XXX make configurable, or autosizing?
                 FILE *tf = tmpfile();
                 if (!tf) {
@@ -200,6 +222,7 @@ namespace Osmium {
                 const osm_object_id_t id = object->get_id() + NodeLocationStore::negative_id_offset;
                 coordinates[id].x = double_to_fix(object->get_lon());
                 coordinates[id].y = double_to_fix(object->get_lat());
+                stored.set(id);
             }
             
             void callback_after_nodes() {
@@ -212,7 +235,11 @@ namespace Osmium {
                 const osm_sequence_id_t num_nodes = object->node_count();
                 for (osm_sequence_id_t i=0; i < num_nodes; i++) {
                     osm_object_id_t node_id = object->nodes[i] + NodeLocationStore::negative_id_offset;
-                    object->set_node_coordinates(i, fix_to_double(coordinates[node_id].x), fix_to_double(coordinates[node_id].y));
+                    if (node_id >= 0 && stored.get(node_id)) {
+                        object->set_node_coordinates(i, fix_to_double(coordinates[node_id].x), fix_to_double(coordinates[node_id].y));
+                    } else {
+                        set_missing_node_coordinates(object, i);
+                    }
                 }
             }
 
@@ -1,10 +1,140 @@
 #ifndef OSMIUM_HANDLER_STATISTICS_HPP
 #define OSMIUM_HANDLER_STATISTICS_HPP
 
+#include <map>
+#include <vector>
+
+#include "IdBitmap.hpp"
 #include "Sqlite.hpp"
 
 namespace Osmium {
 
+    /**
+    * Histogram with buckets growing in powers of two: Bucket 0 counts
+    * the value 0, bucket n the values from 2^(n-1) to 2^n - 1. The last
+    * bucket also counts all bigger values.
+    */
+    class LogHistogram {
+
+      public:
+
+        static const int num_buckets = 64;
+
+      private:
+
+        uint64_t buckets[num_buckets];
+
+      public:
+
+        LogHistogram() {
+            for (int i=0; i < num_buckets; i++) {
+                buckets[i] = 0;
+            }
+        }
+
+        static int bucket(uint64_t value) {
+            if (value == 0) {
+                return 0;
+            }
+            const int b = 64 - __builtin_clzll(value);
+            return b < num_buckets ? b : num_buckets - 1;
+        }
+
+        /// smallest value counted in the bucket
+        static uint64_t bucket_min(int bucket) {
+            return bucket == 0 ? 0 : uint64_t(1) << (bucket - 1);
+        }
+
+        void add(uint64_t value) {
+            buckets[bucket(value)]++;
+        }
+
+        uint64_t count(int bucket) const {
+            return buckets[bucket];
+        }
+
+        void merge(const LogHistogram &other) {
+            for (int i=0; i < num_buckets; i++) {
+                buckets[i] += other.buckets[i];
+            }
+        }
+
+    }; // class LogHistogram
+
+    /**
+    * Number of objects in each block of block_size consecutive ids.
+    * Shows how densely the id space is used, for instance to decide
+    * between the node location stores.
+    *
+    * The first max_dense_blocks blocks are counted in a vector, blocks
+    * of higher ids (there should be few of them) in a map, so a single
+    * huge id doesn't make us allocate counters for all blocks below it.
+    */
+    class IdDensity {
+
+      public:
+
+        static const uint64_t block_size = 1 << 20;
+
+        /// ids below max_dense_blocks * block_size are counted in the vector
+        static const uint64_t max_dense_blocks = 1 << 16;
+
+        typedef std::map<uint64_t, uint32_t> sparse_blocks_t;
+
+      private:
+
+        std::vector<uint32_t> blocks;
+
+        sparse_blocks_t sparse_blocks;
+
+      public:
+
+        IdDensity() : blocks(), sparse_blocks() {
+        }
+
+        void add(osm_object_id_t id) {
+            if (id < 0) { // new objects in osmChange files etc.
+                return;
+            }
+            const uint64_t block = id / block_size;
+            if (block >= max_dense_blocks) {
+                sparse_blocks[block]++;
+                return;
+            }
+            if (block >= blocks.size()) {
+                blocks.resize(block + 1, 0);
+            }
+            blocks[block]++;
+        }
+
+        /// number of blocks in the dense part, see count()
+        uint64_t num_blocks() const {
+            return blocks.size();
+        }
+
+        uint64_t count(uint64_t block) const {
+            return blocks[block];
+        }
+
+        /// counts of the blocks at and above max_dense_blocks
+        const sparse_blocks_t &sparse() const {
+            return sparse_blocks;
+        }
+
+        void merge(const IdDensity &other) {
+            if (other.blocks.size() > blocks.size()) {
+                blocks.resize(other.blocks.size(), 0);
+            }
+            for (unsigned int i=0; i < other.blocks.size(); i++) {
+                blocks[i] += other.blocks[i];
+            }
+            for (sparse_blocks_t::const_iterator it = other.sparse_blocks.begin(); it != other.sparse_blocks.end(); it++) {
+                sparse_blocks[it->first] += it->second;
+            }
+        }
+
+    }; // class IdDensity
+
     namespace Handler {
 
         class Statistics : public Base {
@@ -43,6 +173,33 @@ namespace Osmium {
 
             static const char *stat_names[];
 
+          public:
+
+            enum histogram_t {
+                node_tags_histogram,
+                way_tags_histogram,
+                relation_tags_histogram,
+                way_nodes_histogram,
+                relation_members_histogram,
+                node_version_histogram,
+                way_version_histogram,
+                relation_version_histogram,
+                num_histograms
+            };
+
+          private:
+
+            static const char *histogram_names[];
+
+            LogHistogram histograms[num_histograms];
+
+            /// the users who have edited any of the objects (anonymous edits are not counted)
+            IdBitmap users;
+
+            IdDensity node_ids;
+            IdDensity way_ids;
+            IdDensity relation_ids;
+
             osm_object_id_t id;
             osm_version_t   version;
             int             tag_count;
@@ -58,6 +215,36 @@ namespace Osmium {
                 }
             }
 
+            /**
+            * Add the statistics from another Statistics handler. So the
+            * objects can be counted in several handlers in parallel (each
+            * of them seeing only some of the objects) and merged at the
+            * end.
+            */
+            void merge(const Statistics &other) {
+                for (int i=0; stat_names[i]; i++) {
+                    uint64_t &value = ((uint64_t *) &stats)[i];
+                    const uint64_t other_value = ((const uint64_t *) &other.stats)[i];
+                    if (!strncmp(stat_names[i], "max_", 4)) {
+                        value = std::max(value, other_value);
+                    } else {
+                        value += other_value;
+                    }
+                }
+                for (int i=0; i < num_histograms; i++) {
+                    histograms[i].merge(other.histograms[i]);
+                }
+                users.merge(other.users);
+                stats.users = users.count();
+                node_ids.merge(other.node_ids);
+                way_ids.merge(other.way_ids);
+                relation_ids.merge(other.relation_ids);
+            }
+
+            const LogHistogram &get_histogram(histogram_t histogram) const {
+                return histograms[histogram];
+            }
+
             void callback_object(const OSM::Object *object) {
                 id        = object->get_id();
                 version   = object->get_version();
@@ -66,6 +253,8 @@ namespace Osmium {
                 osm_user_id_t uid = object->get_uid();
                 if (uid == 0)
                     stats.anon_user_objects++;
+                else if (uid > 0)
+                    users.set(uid);
                 if (uid > (int64_t) stats.max_user_id)
                     stats.max_user_id = uid;
 
@@ -86,6 +275,11 @@ namespace Osmium {
                 if (version > (int64_t) stats.max_node_version)
                     stats.max_node_version = version;
                 stats.sum_node_version += version;
+                histograms[node_tags_histogram].add(tag_count);
+                if (version >= 0) { // objects without version from PBF files have -1
+                    histograms[node_version_histogram].add(version);
+                }
+                node_ids.add(id);
             }
 
             void callback_way(const OSM::Way *object) {
@@ -103,6 +297,12 @@ namespace Osmium {
                 if (version > (int64_t) stats.max_way_version)
                     stats.max_way_version = version;
                 stats.sum_way_version += version;
+                histograms[way_tags_histogram].add(tag_count);
+                histograms[way_nodes_histogram].add(object->node_count());
+                if (version >= 0) {
+                    histograms[way_version_histogram].add(version);
+                }
+                way_ids.add(id);
             }
 
             void callback_relation(const OSM::Relation *object) {
@@ -119,17 +319,55 @@ namespace Osmium {
                 if (version > (int64_t) stats.max_relation_version)
                     stats.max_relation_version = version;
                 stats.sum_relation_version += version;
+                histograms[relation_tags_histogram].add(tag_count);
+                histograms[relation_members_histogram].add(member_count);
+                if (version >= 0) {
+                    histograms[relation_version_histogram].add(version);
+                }
+                relation_ids.add(id);
+            }
+
+            void write_id_density(Sqlite::Statement *statement, const char *type, const IdDensity &density) {
+                for (uint64_t block=0; block < density.num_blocks(); block++) {
+                    if (density.count(block)) {
+                        statement
+                            ->bind_text(type)
+                            ->bind_int64(block * IdDensity::block_size)
+                            ->bind_int64(density.count(block))
+                            ->execute();
+                    }
+                }
+                for (IdDensity::sparse_blocks_t::const_iterator it = density.sparse().begin(); it != density.sparse().end(); it++) {
+                    statement
+                        ->bind_text(type)
+                        ->bind_int64(it->first * IdDensity::block_size)
+                        ->bind_int64(it->second)
+                        ->execute();
+                }
             }
 
             void callback_final() {
+                stats.users = users.count();
+
                 unlink("count.db");
                 db = new Sqlite::Database("count.db");
+                db->optimize_for_bulk_load();
 
                 sqlite3 *sqlite_db = db->get_sqlite3();
                 if (SQLITE_OK != sqlite3_exec(sqlite_db, \
                     "CREATE TABLE stats (" \
                     "  key    TEXT, " \
                     "  value  INT64 " \
+                    ");" \
+                    "CREATE TABLE histograms (" \
+                    "  name   TEXT, " \
+                    "  min    INT64, " \
+                    "  count  INT64 " \
+                    ");" \
+                    "CREATE TABLE id_density (" \
+                    "  type     TEXT, " \
+                    "  first_id INT64, " \
+                    "  count    INT64 " \
                     ");", 0, 0, 0)) {
                     std::cerr << "Database error: " << sqlite3_errmsg(sqlite_db) << "\n";
                     sqlite3_close(sqlite_db);
@@ -154,7 +392,28 @@ namespace Osmium {
                         
 //                out_stats.close();
 
+                Sqlite::Statement *statement_insert_into_histograms = db->prepare("INSERT INTO histograms (name, min, count) VALUES (?, ?, ?);");
+                for (int i=0; i < num_histograms; i++) {
+                    for (int bucket=0; bucket < LogHistogram::num_buckets; bucket++) {
+                        if (histograms[i].count(bucket)) {
+                            statement_insert_into_histograms
+                                ->bind_text(histogram_names[i])
+                                ->bind_int64(LogHistogram::bucket_min(bucket))
+                                ->bind_int64(histograms[i].count(bucket))
+                                ->execute();
+                        }
+                    }
+                }
+
+                Sqlite::Statement *statement_insert_into_id_density = db->prepare("INSERT INTO id_density (type, first_id, count) VALUES (?, ?, ?);");
+                write_id_density(statement_insert_into_id_density, "node",     node_ids);
+                write_id_density(statement_insert_into_id_density, "way",      way_ids);
+                write_id_density(statement_insert_into_id_density, "relation", relation_ids);
+
                 db->commit();
+                delete statement_insert_into_id_density;
+                delete statement_insert_into_histograms;
+                delete statement_insert_into_main_stats;
 
                 db->close();
             }
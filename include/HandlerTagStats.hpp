@@ -2,12 +2,20 @@
 #define OSMIUM_HANDLER_TAGSTATS_HPP
 
 #include <google/sparse_hash_map>
+#include <algorithm>
 #include <bitset>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <gd.h>
 
 #include "Sqlite.hpp"
+#include "HyperLogLog.hpp"
 
 union counter_t {
     uint32_t count[4];
@@ -17,34 +25,334 @@ union counter_t {
         uint32_t ways;
         uint32_t relations;
     } by_type;
-};
 
-/* hash function that seems to work well with tag key/value strings */
-struct djb2_hash {
-    size_t operator()(const char *str) const {
-        size_t hash = 5381;
-        int c;
+    void increment(int type) {
+        count[0]++;
+        count[type]++;
+    }
 
-        while ((c = *str++)) {
-            hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+    /// add the counts from another counter (for instance one from another thread)
+    void add(const counter_t &other) {
+        for (int i=0; i < 4; i++) {
+            count[i] += other.count[i];
         }
-
-        return hash;
     }
 };
 
-/* string comparison for google hash map */
-struct eqstr {
-    bool operator()(const char* s1, const char* s2) const {
-        return (s1 == s2) || (s1 && s2 && strcmp(s1, s2) == 0);
-    }
-};
+// keys are ids of interned strings (values or keys, depending on the map)
+typedef google::sparse_hash_map<StringStore::string_id_t, counter_t> value_hash_map;
 
-typedef google::sparse_hash_map<const char *, counter_t, djb2_hash, eqstr> value_hash_map;
+// values are bitmasks of the object types (1 << type) the user has used the key on
 typedef google::sparse_hash_map<osm_user_id_t, uint32_t> user_hash_map;
 
 namespace Osmium {
 
+    /**
+    * The cells of the location image (half a degree in each direction)
+    * in which a key was used. Most keys are used only in a few places,
+    * so the cells are kept in a sorted list. Only if that would need
+    * more memory than a bitset with all cells the bitset is used.
+    */
+    class LocationGrid {
+
+      public:
+
+        static const int y_size = 360;
+        static const int x_size = 2 * y_size;
+        static const int num_cells = x_size * y_size;
+
+        typedef std::bitset<num_cells> bitset_t;
+
+      private:
+
+        /// the list needs 32 bits per cell, the bitset 1 bit per possible cell
+        static const unsigned int max_sparse_cells = num_cells / 32;
+
+        std::vector<uint32_t> cells; // sorted, only used while dense is NULL
+        bitset_t *dense;
+
+        /// the cell set last, objects close to each other are often in the same cell
+        int last_cell;
+
+        LocationGrid(const LocationGrid &);
+        LocationGrid &operator=(const LocationGrid &);
+
+      public:
+
+        LocationGrid() : cells(), dense(NULL), last_cell(-1) {
+        }
+
+        ~LocationGrid() {
+            delete dense;
+        }
+
+        void set(int cell) {
+            if (cell == last_cell) {
+                return;
+            }
+            last_cell = cell;
+
+            if (dense) {
+                (*dense)[cell] = true;
+                return;
+            }
+
+            std::vector<uint32_t>::iterator it = std::lower_bound(cells.begin(), cells.end(), uint32_t(cell));
+            if (it != cells.end() && *it == uint32_t(cell)) {
+                return;
+            }
+            cells.insert(it, cell);
+
+            if (cells.size() > max_sparse_cells) {
+                dense = new bitset_t();
+                for (it = cells.begin(); it != cells.end(); it++) {
+                    (*dense)[*it] = true;
+                }
+                std::vector<uint32_t>().swap(cells);
+            }
+        }
+
+        /// returns the first cell >= from that is set, -1 if there is none
+        int next(int from) const {
+            if (dense) {
+                for (int n=from; n < num_cells; n++) {
+                    if ((*dense)[n]) {
+                        return n;
+                    }
+                }
+                return -1;
+            }
+            std::vector<uint32_t>::const_iterator it = std::lower_bound(cells.begin(), cells.end(), uint32_t(from));
+            return it == cells.end() ? -1 : int(*it);
+        }
+
+        bool is_dense() const {
+            return dense != NULL;
+        }
+
+        size_t memory_usage() const {
+            return dense ? sizeof(bitset_t) : cells.capacity() * sizeof(uint32_t);
+        }
+
+        /**
+        * Get the cell for the given coordinates. Returns -1 if they are
+        * not valid (for instance way nodes whose location was not found).
+        */
+        static int cell(double lon, double lat) {
+            if (!(lon >= -180 && lon <= 180 && lat >= -90 && lat <= 90)) {
+                return -1;
+            }
+            // lon=180 and lat=-90 would be just outside the image
+            const int x = std::min(         int(2 * (lon + 180)), x_size - 1);
+            const int y = std::max(y_size - int(2 * (lat +  90)), 0);
+            return x_size * std::min(y, y_size - 1) + x;
+        }
+
+    }; // class LocationGrid
+
+    /**
+    * Counts of key pairs in one flat open addressing hash table (linear
+    * probing). The key of the table is the pair of key ids packed into
+    * 64 bits, the smaller key (by string order) in the upper half.
+    *
+    * With max_entries > 0 only the most frequent pairs are kept using
+    * the Space-Saving algorithm (Metwally et al., "Efficient computation
+    * of frequent and top-k elements in data streams", 2005): If the
+    * table is full, the pair with the smallest count is replaced by the
+    * new pair, which inherits the count plus one. So the count of a
+    * pair in the table is never too small and at most by the smallest
+    * count in the table too big. The counts by type are only counted
+    * after a pair (re)entered the table. The entries are kept in a heap
+    * ordered by count to find the smallest one quickly.
+    */
+    class KeyPairTable {
+
+      public:
+
+        typedef uint64_t pair_t;
+
+        struct entry_t {
+            pair_t       pair;
+            counter_t    counter;
+            uint32_t     heap_pos; ///< position in heap, only used if the size is limited
+        };
+
+        static pair_t make_pair(StringStore::string_id_t key1, StringStore::string_id_t key2) {
+            return (pair_t(key1) << 32) | key2;
+        }
+
+        static StringStore::string_id_t first(pair_t pair) {
+            return pair >> 32;
+        }
+
+        static StringStore::string_id_t second(pair_t pair) {
+            return pair & 0xffffffff;
+        }
+
+      private:
+
+        size_t max_entries;
+
+        std::vector<entry_t> entries;
+
+        /// the hash table, index into entries plus one, 0 for empty slots
+        std::vector<uint32_t> slots;
+        size_t mask;
+
+        /// indexes into entries, a min-heap by counter.by_type.all (only if max_entries > 0)
+        std::vector<uint32_t> heap;
+
+        size_t home(pair_t pair) const {
+            return (pair * 0x9e3779b97f4a7c15ULL) >> 32 & mask;
+        }
+
+        void resize_slots(size_t size) {
+            slots.assign(size, 0);
+            mask = size - 1;
+            for (uint32_t i=0; i < entries.size(); i++) {
+                size_t s = home(entries[i].pair);
+                while (slots[s]) {
+                    s = (s + 1) & mask;
+                }
+                slots[s] = i + 1;
+            }
+        }
+
+        /// returns the slot of the pair or the empty slot where it should go
+        size_t find_slot(pair_t pair) const {
+            size_t s = home(pair);
+            while (slots[s] && entries[slots[s] - 1].pair != pair) {
+                s = (s + 1) & mask;
+            }
+            return s;
+        }
+
+        /// remove entry from slot s, moving later entries of the same cluster back
+        void erase_slot(size_t s) {
+            size_t j = s;
+            while (true) {
+                j = (j + 1) & mask;
+                if (!slots[j]) {
+                    break;
+                }
+                const size_t k = home(entries[slots[j] - 1].pair);
+                // move the entry in j to s unless its home lies cyclically in (s, j]
+                if ((s < j) ? (k <= s || k > j) : (k <= s && k > j)) {
+                    slots[s] = slots[j];
+                    s = j;
+                }
+            }
+            slots[s] = 0;
+        }
+
+        bool heap_less(uint32_t a, uint32_t b) const {
+            return entries[heap[a]].counter.by_type.all < entries[heap[b]].counter.by_type.all;
+        }
+
+        void heap_swap(uint32_t a, uint32_t b) {
+            std::swap(heap[a], heap[b]);
+            entries[heap[a]].heap_pos = a;
+            entries[heap[b]].heap_pos = b;
+        }
+
+        void sift_up(uint32_t pos) {
+            while (pos > 0 && heap_less(pos, (pos - 1) / 2)) {
+                heap_swap(pos, (pos - 1) / 2);
+                pos = (pos - 1) / 2;
+            }
+        }
+
+        void sift_down(uint32_t pos) {
+            while (true) {
+                uint32_t smallest = pos;
+                const uint32_t left = 2 * pos + 1;
+                if (left < heap.size() && heap_less(left, smallest)) smallest = left;
+                if (left + 1 < heap.size() && heap_less(left + 1, smallest)) smallest = left + 1;
+                if (smallest == pos) {
+                    return;
+                }
+                heap_swap(pos, smallest);
+                pos = smallest;
+            }
+        }
+
+      public:
+
+        KeyPairTable(size_t max_entries=0) : max_entries(max_entries), entries(), slots(), heap() {
+            size_t size = 1024;
+            while (max_entries && size < 2 * max_entries) {
+                size *= 2;
+            }
+            resize_slots(size);
+            if (max_entries) {
+                entries.reserve(max_entries);
+                heap.reserve(max_entries);
+            }
+        }
+
+        void add(StringStore::string_id_t key1, StringStore::string_id_t key2, int type) {
+            const pair_t pair = make_pair(key1, key2);
+            size_t s = find_slot(pair);
+
+            if (slots[s]) {
+                entry_t &e = entries[slots[s] - 1];
+                e.counter.increment(type);
+                if (max_entries) {
+                    sift_down(e.heap_pos);
+                }
+                return;
+            }
+
+            if (max_entries && entries.size() == max_entries) {
+                // replace the pair with the smallest count
+                const uint32_t i = heap[0];
+                entry_t &e = entries[i];
+                erase_slot(find_slot(e.pair));
+                s = find_slot(pair);
+                const uint32_t min_count = e.counter.by_type.all;
+                e.pair = pair;
+                memset(&e.counter, 0, sizeof(e.counter));
+                e.counter.increment(type);
+                e.counter.by_type.all = min_count + 1;
+                slots[s] = i + 1;
+                sift_down(0);
+                return;
+            }
+
+            entry_t e;
+            e.pair = pair;
+            memset(&e.counter, 0, sizeof(e.counter));
+            e.counter.increment(type);
+            e.heap_pos = heap.size();
+            entries.push_back(e);
+            slots[s] = entries.size();
+
+            if (max_entries) {
+                heap.push_back(entries.size() - 1);
+                sift_up(heap.size() - 1);
+            } else if (entries.size() * 10 > slots.size() * 7) {
+                resize_slots(slots.size() * 2);
+            }
+        }
+
+        const std::vector<entry_t> &get_entries() const {
+            return entries;
+        }
+
+        size_t size() const {
+            return entries.size();
+        }
+
+        size_t bucket_count() const {
+            return slots.size();
+        }
+
+        size_t memory_usage() const {
+            return entries.capacity() * sizeof(entry_t) + slots.capacity() * sizeof(uint32_t) + heap.capacity() * sizeof(uint32_t);
+        }
+
+    }; // class KeyPairTable
+
     class ObjectTagStat {
 
     public:
@@ -54,195 +362,630 @@ namespace Osmium {
         counter_t users;
 
         value_hash_map values_stat;
-        value_hash_map keypairs_stat;
-        user_hash_map  users_stat;
 
-        static const int location_image_y_size = 360;
-        static const int location_image_x_size = 2 * location_image_y_size;
+        /// the users of this key, NULL after switching to users_estimate
+        user_hash_map *users_stat;
+
+        /// estimates of the number of users (all and by type), only used in approximate mode
+        HyperLogLog *users_estimate[4];
+
+        /// precision of the HyperLogLog sketches, 0 if users are always counted exactly
+        int users_precision;
 
-        std::bitset<location_image_x_size * location_image_y_size> location;
+        static const int location_image_y_size = LocationGrid::y_size;
+        static const int location_image_x_size = LocationGrid::x_size;
+
+        LocationGrid location;
 
         int grids;
 
-        ObjectTagStat() {
+        ObjectTagStat(int users_precision=0) : users_precision(users_precision) {
             memset(&key,    0, sizeof(key));
             memset(&values, 0, sizeof(key));
             memset(&users,  0, sizeof(key));
             grids = 0;
+            users_stat = new user_hash_map();
+            for (int i=0; i < 4; i++) {
+                users_estimate[i] = NULL;
+            }
+        }
+
+        ~ObjectTagStat() {
+            delete users_stat;
+            for (int i=0; i < 4; i++) {
+                delete users_estimate[i];
+            }
+        }
+
+        /**
+        * Remember that the user has used this key on an object of the
+        * given type. In approximate mode the users are counted exactly
+        * only until the hash map would need about as much memory as the
+        * HyperLogLog sketches, then the sketches are used. So keys used
+        * by only a few users (that is most of them) still get exact
+        * numbers.
+        */
+        void add_user(osm_user_id_t uid, int type) {
+            if (users_stat) {
+                (*users_stat)[uid] |= 1 << type;
+                if (users_precision && users_stat->size() > (size_t(1) << (users_precision - 1))) {
+                    switch_to_estimate();
+                }
+            } else {
+                users_estimate[0]->add(uid);
+                users_estimate[type]->add(uid);
+            }
+        }
+
+        void switch_to_estimate() {
+            for (int i=0; i < 4; i++) {
+                users_estimate[i] = new HyperLogLog(users_precision);
+            }
+            for (user_hash_map::const_iterator it = users_stat->begin(); it != users_stat->end(); it++) {
+                users_estimate[0]->add(it->first);
+                for (int type=1; type < 4; type++) {
+                    if (it->second & (1 << type)) {
+                        users_estimate[type]->add(it->first);
+                    }
+                }
+            }
+            delete users_stat;
+            users_stat = NULL;
+        }
+
+        /// set the users counter from the exact users or the estimates
+        void count_users() {
+            if (users_stat) {
+                memset(&users, 0, sizeof(users));
+                users.by_type.all = users_stat->size();
+                for (user_hash_map::const_iterator it = users_stat->begin(); it != users_stat->end(); it++) {
+                    for (int type=1; type < 4; type++) {
+                        if (it->second & (1 << type)) {
+                            users.count[type]++;
+                        }
+                    }
+                }
+            } else {
+                for (int i=0; i < 4; i++) {
+                    users.count[i] = users_estimate[i]->estimate();
+                }
+            }
         }
 
     }; // class ObjectTagStat
 
-    namespace Handler {
+    /**
+    * The tags of a number of objects, keys and values given as ids in
+    * the string stores of the TagStats handler. The tags of each object
+    * are sorted by key, so that in each key pair the first key is the
+    * smaller one.
+    */
+    struct TagStatsBatch {
+
+        struct object_t {
+            osm_object_type_t type;
+            osm_user_id_t     uid;
+            unsigned int      first_tag;      ///< index of the first tag of this object in tags
+            unsigned int      num_tags;
+            unsigned int      first_location; ///< index of the first LocationGrid cell of this object in locations
+            unsigned int      num_locations;
+        };
+
+        typedef std::pair<StringStore::string_id_t, StringStore::string_id_t> tag_t;
 
-        typedef google::sparse_hash_map<const char *, ObjectTagStat *, djb2_hash, eqstr> tag_hash_map;
+        std::vector<object_t> objects;
+        std::vector<tag_t>    tags;
+        std::vector<int>      locations;
+
+    }; // struct TagStatsBatch
+
+    namespace Handler {
 
         class TagStats : public Base {
 
+            /**
+            * The statistics are partitioned by key: Each key belongs to
+            * exactly one shard and only the worker thread of that shard
+            * updates its ObjectTagStat. So the workers don't need any
+            * locks and there is nothing to merge at the end.
+            */
+            struct Shard {
+
+                // Keys and values are interned in different string stores.
+                // There are only few different keys, so their ids are small
+                // and can be used as index into the tags_stat vector.
+                // Only keys belonging to this shard are set.
+                std::vector<ObjectTagStat *> tags_stat;
+
+                /// number of tags counted in this shard
+                counter_t tags;
+
+                /// batches this shard still has to count (protected by queue_mutex)
+                std::deque< std::shared_ptr<const TagStatsBatch> > queue;
+
+                /// is the worker counting a batch right now? (protected by queue_mutex)
+                bool busy;
+
+                /// counts of the key pairs whose first key belongs to this shard
+                KeyPairTable keypairs;
+
+                Shard(size_t max_keypairs) : tags_stat(), queue(), busy(false), keypairs(max_keypairs) {
+                    memset(&tags, 0, sizeof(tags));
+                }
+
+            }; // struct Shard
+
+            /// a location image encoded as PNG, waiting to be written to the database
+            struct LocationPng {
+                const char *key;
+                void *data; ///< allocated by gd, free with gdFree()
+                int size;
+            };
+
+            /**
+            * State shared by the threads rendering the location images
+            * and the thread writing them to the database, see
+            * print_images(). All members are protected by mutex.
+            */
+            struct ImageRendering {
+                std::mutex mutex;
+                std::condition_variable not_empty;
+                std::condition_variable not_full;
+
+                /// the next key to be rendered by any renderer
+                StringStore::string_id_t next_key_id;
+
+                /// rendered images not yet written to the database
+                std::deque<LocationPng> queue;
+
+                /// number of renderers not yet finished
+                unsigned int running;
+
+                // merged from the renderers when they are finished
+                LocationGrid::bitset_t location_all;
+                int dense_grids;
+                uint64_t grids_memory;
+            }; // struct ImageRendering
+
+            /// maximum number of rendered images waiting for the database writer
+            static const unsigned int max_png_queue_size = 64;
+
             time_t timer;
 
-            tag_hash_map             tags_stat;
-            tag_hash_map::iterator   tags_iterator;
-            value_hash_map::iterator values_iterator;
-            user_hash_map::iterator  users_iterator;
+            std::vector<Shard *> shards;
+
+            /// one worker thread per shard, none if everything is counted in the main thread
+            std::vector<std::thread> workers;
+
+            /// maximum number of batches waiting in the queue of a shard
+            static const unsigned int max_queue_size = 4;
+
+            /// number of objects collected in a batch before it is handed to the workers
+            static const unsigned int batch_size = 10000;
+
+            std::mutex queue_mutex;
+            std::condition_variable queue_not_empty;
+            std::condition_variable queue_not_full;
+            std::condition_variable workers_idle;
+
+            /// tells workers to stop when their queue is empty (protected by queue_mutex)
+            bool shutdown;
 
-            char max_timestamp[Osmium::OSM::Object::max_length_timestamp];
+            /// objects collected in the main thread, not yet handed to the workers
+            TagStatsBatch *batch;
+
+            // order of the tags of the current object sorted by key
+            std::vector<int> tag_order;
+
+            time_t max_timestamp;
+
+            /// precision of the HyperLogLog sketches used to estimate the number of users, 0 for exact counts
+            int users_precision;
+
+            /// add the locations of way nodes to the location grids (needs a node location store)
+            bool way_locations;
+
+            /// have the location grid images been written yet? (see dump_images())
+            bool images_dumped;
+
+            /// write the keys, tags and keypairs tables into database files of their own in parallel
+            bool separate_table_dbs;
 
             // this must be much bigger than the largest string we want to store
-            static const int string_store_size = 1024 * 1024 * 10;
-            StringStore *string_store;
+            static const int string_store_size = 1024 * 1024;
+            StringStore *key_store;
+            StringStore *value_store;
 
             Sqlite::Database *db;
 
         public:
 
-            TagStats(bool debug) : Base(debug) {
-                string_store = new StringStore(string_store_size);
-                max_timestamp[0] = 0;
+            unsigned int shard_of(StringStore::string_id_t key_id) const {
+                return key_id % shards.size();
+            }
+
+            /// get the statistics for the given key, NULL if it was never seen
+            ObjectTagStat *find_stat(StringStore::string_id_t key_id) const {
+                const Shard *shard = shards[shard_of(key_id)];
+                return key_id < shard->tags_stat.size() ? shard->tags_stat[key_id] : NULL;
+            }
+
+            ObjectTagStat *get_stat(Shard *shard, StringStore::string_id_t key_id) const {
+                if (key_id >= shard->tags_stat.size()) {
+                    shard->tags_stat.resize(key_id + 1, NULL);
+                }
+                ObjectTagStat *stat = shard->tags_stat[key_id];
+                if (! stat) {
+                    stat = new ObjectTagStat(users_precision);
+                    shard->tags_stat[key_id] = stat;
+                }
+                return stat;
             }
 
-            void update_tag_stats(ObjectTagStat *stat, const char * /* key */, const char *value, OSM::Object *object) {
-                stat->key.count[0]++;
-                stat->key.count[object->get_type()]++;
+            static void update_tag_stats(ObjectTagStat *stat, StringStore::string_id_t value_id, const TagStatsBatch::object_t &object, const int *locations) {
+                stat->key.increment(object.type);
 
-                values_iterator = stat->values_stat.find(value);
+                value_hash_map::iterator values_iterator = stat->values_stat.find(value_id);
                 if (values_iterator == stat->values_stat.end()) {
-                    const char *ptr = string_store->add(value);
                     counter_t counter;
-                    counter.count[0]                  = 1;
-                    counter.count[1]                  = 0;
-                    counter.count[2]                  = 0;
-                    counter.count[3]                  = 0;
-                    counter.count[object->get_type()] = 1;
-                    stat->values_stat.insert(std::pair<const char *, counter_t>(ptr, counter));
-                    stat->values.count[0]++;
-                    stat->values.count[object->get_type()]++;
+                    memset(&counter, 0, sizeof(counter));
+                    counter.increment(object.type);
+                    stat->values_stat.insert(std::pair<StringStore::string_id_t, counter_t>(value_id, counter));
+                    stat->values.increment(object.type);
                 } else {
-                    values_iterator->second.count[0]++;
-                    values_iterator->second.count[object->get_type()]++;
-                    if (values_iterator->second.count[object->get_type()] == 1) {
-                        stat->values.count[object->get_type()]++;
+                    values_iterator->second.increment(object.type);
+                    if (values_iterator->second.count[object.type] == 1) {
+                        stat->values.count[object.type]++;
                     }
                 }
 
-                stat->users_stat[object->get_uid()]++;
+                stat->add_user(object.uid, object.type);
 
-                if (object->get_type() == NODE) {
-                    int x =                                                int(2 * (((OSM::Node *)object)->get_lon() + 180));
-                    int y = Osmium::ObjectTagStat::location_image_y_size - int(2 * (((OSM::Node *)object)->get_lat() +  90));
-                    stat->location[Osmium::ObjectTagStat::location_image_x_size * y + x] = true;
+                for (unsigned int i=0; i < object.num_locations; i++) {
+                    stat->location.set(locations[i]);
                 }
+
             }
 
-            void callback_object(OSM::Object *object) {
-                ObjectTagStat *stat;
+            /// count the tags in the batch whose keys belong to the given shard
+            void count_batch(unsigned int shard_id, const TagStatsBatch &b) {
+                Shard *shard = shards[shard_id];
+                for (std::vector<TagStatsBatch::object_t>::const_iterator o = b.objects.begin(); o != b.objects.end(); o++) {
+                    const TagStatsBatch::tag_t *tags = &b.tags[o->first_tag];
+                    for (unsigned int i=0; i < o->num_tags; i++) {
+                        if (shard_of(tags[i].first) != shard_id) {
+                            continue;
+                        }
+                        ObjectTagStat *stat = get_stat(shard, tags[i].first);
+                        update_tag_stats(stat, tags[i].second, *o, b.locations.data() + o->first_location);
+                        shard->tags.increment(o->type);
 
-                if (strcmp(max_timestamp, object->get_timestamp_str()) < 0) {
-                    memccpy(max_timestamp, object->get_timestamp_str(), 0, Osmium::OSM::Object::max_length_timestamp);
+                        // count key pairs, the tags are sorted by key so this is the smaller key of each pair
+                        for (unsigned int j=i+1; j < o->num_tags; j++) {
+                            shard->keypairs.add(tags[i].first, tags[j].first, o->type);
+                        }
+                    }
                 }
+            }
 
-                int tag_count = object->tag_count();
-                for (int i=0; i<tag_count; i++) {
-                    const char* key = object->get_tag_key(i);
+            void worker(unsigned int shard_id) {
+                Shard *shard = shards[shard_id];
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                while (true) {
+                    while (shard->queue.empty() && !shutdown) {
+                        queue_not_empty.wait(lock);
+                    }
+                    if (shard->queue.empty()) {
+                        return;
+                    }
 
-                    tags_iterator = tags_stat.find(key);
-                    if (tags_iterator == tags_stat.end()) {
-                        stat = new ObjectTagStat();
-                        tags_stat.insert(std::pair<const char *, ObjectTagStat *>(string_store->add(key), stat));
-                    } else {
-                        stat = tags_iterator->second;
+                    std::shared_ptr<const TagStatsBatch> b = shard->queue.front();
+                    shard->queue.pop_front();
+                    shard->busy = true;
+                    queue_not_full.notify_one();
+
+                    lock.unlock();
+                    count_batch(shard_id, *b);
+                    b.reset();
+                    lock.lock();
+
+                    shard->busy = false;
+                    workers_idle.notify_all();
+                }
+            }
+
+            /**
+            * Hand the objects collected so far to the workers, or count
+            * them right away if there are no workers. Blocks while the
+            * queue of any shard is full.
+            */
+            void flush() {
+                if (batch->objects.empty()) {
+                    return;
+                }
+
+                if (workers.empty()) {
+                    for (unsigned int i=0; i < shards.size(); i++) {
+                        count_batch(i, *batch);
                     }
-                    update_tag_stats(stat, key, object->get_tag_value(i), object);
-                }
-
-                // count key pairs
-                for (int i=0; i<tag_count; i++) {
-                    for (int j=i+1; j<tag_count; j++) {
-                        const char *first  = object->get_tag_key(i);
-                        const char *second = object->get_tag_key(j);
-                        const char *min, *max;
-                        if (strcmp(first, second) < 0) { // a strcmp is not strictly necessary here, optimize?
-                            min = first;
-                            max = second;
-                        } else {
-                            min = second;
-                            max = first;
-                        }
-                        stat = tags_stat.find(min)->second;
-                        const char *key = tags_stat.find(max)->first;
-
-                        values_iterator = stat->keypairs_stat.find(key);
-                        if (values_iterator == stat->keypairs_stat.end()) {
-                            counter_t counter;
-                            counter.count[0]                  = 1;
-                            counter.count[1]                  = 0;
-                            counter.count[2]                  = 0;
-                            counter.count[3]                  = 0;
-                            counter.count[object->get_type()] = 1;
-                            stat->keypairs_stat.insert(std::pair<const char *, counter_t>(key, counter));
-                        } else {
-                            values_iterator->second.count[0]++;
-                            values_iterator->second.count[object->get_type()]++;
-                        }
+                    batch->objects.clear();
+                    batch->tags.clear();
+                    batch->locations.clear();
+                    return;
+                }
 
+                std::shared_ptr<const TagStatsBatch> b(batch);
+                batch = new TagStatsBatch();
+
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                for (std::vector<Shard *>::iterator it = shards.begin(); it != shards.end(); it++) {
+                    while ((*it)->queue.size() >= max_queue_size) {
+                        queue_not_full.wait(lock);
                     }
+                    (*it)->queue.push_back(b);
                 }
+                queue_not_empty.notify_all();
             }
 
-            void print_images() {
-                std::bitset<Osmium::ObjectTagStat::location_image_x_size * Osmium::ObjectTagStat::location_image_y_size> location_all;
-                int sum_size=0;
+            /// Wait until the workers have counted all objects seen so far.
+            void wait_for_workers() {
+                flush();
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                for (std::vector<Shard *>::iterator it = shards.begin(); it != shards.end(); it++) {
+                    while (!(*it)->queue.empty() || (*it)->busy) {
+                        workers_idle.wait(lock);
+                    }
+                }
+            }
 
-                Sqlite::Statement *statement_insert_into_key_distributions = db->prepare("INSERT INTO key_distributions (key, png) VALUES (?, ?);");
-                db->begin_transaction();
+            void stop_workers() {
+                {
+                    std::lock_guard<std::mutex> lock(queue_mutex);
+                    shutdown = true;
+                }
+                queue_not_empty.notify_all();
+                for (std::vector<std::thread>::iterator it = workers.begin(); it != workers.end(); it++) {
+                    it->join();
+                }
+                workers.clear();
+            }
+
+            /**
+            * Create TagStats handler. With num_workers > 0 the tags are
+            * counted in that many worker threads, each of them responsible
+            * for the keys of one shard.
+            *
+            * With users_precision > 0 the number of users of keys used by
+            * many users is estimated with HyperLogLog sketches of that
+            * precision (see HyperLogLog), this saves a lot of memory.
+            *
+            * With way_locations set the locations of the nodes of ways are
+            * added to the location images of their keys, too. The node
+            * locations must have been set by a NodeLocationStore then.
+            *
+            * With max_keypairs > 0 only about that many of the most common
+            * key pairs are counted (see KeyPairTable).
+            *
+            * With separate_table_dbs the keys, tags and keypairs tables
+            * are first written into database files of their own (in
+            * parallel) and then copied into taginfo-db.db.
+            */
+            TagStats(bool debug, int num_workers=0, int users_precision=0, bool way_locations=false, size_t max_keypairs=0, bool separate_table_dbs=false) : Base(debug), users_precision(users_precision), way_locations(way_locations), images_dumped(false), separate_table_dbs(separate_table_dbs) {
+                if (users_precision) {
+                    HyperLogLog check(users_precision); // throws if precision is out of range
+                }
+                key_store   = new StringStore(string_store_size);
+                value_store = new StringStore(string_store_size);
+                max_timestamp = 0;
+                shutdown = false;
+                batch = new TagStatsBatch();
+
+                const int num_shards = std::max(num_workers, 1);
+                for (int i=0; i < num_shards; i++) {
+                    shards.push_back(new Shard((max_keypairs + num_shards - 1) / num_shards));
+                }
+                for (int i=0; i < num_workers; i++) {
+                    workers.push_back(std::thread(&TagStats::worker, this, i));
+                }
+            }
 
-                for (tags_iterator = tags_stat.begin(); tags_iterator != tags_stat.end(); tags_iterator++) {
-                    const char *key = tags_iterator->first;
-                    ObjectTagStat *stat = tags_iterator->second;
+            ~TagStats() {
+                stop_workers();
+                delete batch;
+                for (std::vector<Shard *>::iterator it = shards.begin(); it != shards.end(); it++) {
+                    for (std::vector<ObjectTagStat *>::iterator stat = (*it)->tags_stat.begin(); stat != (*it)->tags_stat.end(); stat++) {
+                        delete *stat;
+                    }
+                    delete *it;
+                }
+                delete value_store;
+                delete key_store;
+            }
+
+            void callback_object(OSM::Object *object) {
+                if (object->get_timestamp() > max_timestamp) {
+                    max_timestamp = object->get_timestamp();
+                }
+
+                const int tag_count = object->tag_count();
+                if (tag_count == 0) {
+                    return;
+                }
+
+                // sort the tags by key (insertion sort, there are only few tags)
+                tag_order.resize(tag_count);
+                for (int i=0; i < tag_count; i++) {
+                    int j = i;
+                    for (; j > 0 && strcmp(object->get_tag_key(tag_order[j-1]), object->get_tag_key(i)) > 0; j--) {
+                        tag_order[j] = tag_order[j-1];
+                    }
+                    tag_order[j] = i;
+                }
+
+                TagStatsBatch::object_t o;
+                o.type      = object->get_type();
+                o.uid       = object->get_uid();
+                o.first_tag = batch->tags.size();
+                o.num_tags  = tag_count;
+                o.first_location = batch->locations.size();
+
+                if (o.type == NODE) {
+                    const int cell = LocationGrid::cell(((OSM::Node *)object)->get_lon(), ((OSM::Node *)object)->get_lat());
+                    if (cell >= 0) {
+                        batch->locations.push_back(cell);
+                    }
+                } else if (o.type == WAY && way_locations) {
+                    // cells of all way nodes, consecutive nodes are often in the same cell;
+                    // nodes missing from the location store have NaN coordinates and no cell
+                    const OSM::Way *way = (OSM::Way *)object;
+                    int last_cell = -1;
+                    for (osm_sequence_id_t i=0; i < way->node_count(); i++) {
+                        const int cell = LocationGrid::cell(way->lon[i], way->lat[i]);
+                        if (cell >= 0 && cell != last_cell) {
+                            batch->locations.push_back(cell);
+                            last_cell = cell;
+                        }
+                    }
+                }
+                o.num_locations = batch->locations.size() - o.first_location;
+
+                for (int i=0; i < tag_count; i++) {
+                    batch->tags.push_back(TagStatsBatch::tag_t(key_store->intern(object->get_tag_key(tag_order[i])),
+                                                             value_store->intern(object->get_tag_value(tag_order[i]))));
+                }
+                batch->objects.push_back(o);
+
+                if (workers.empty() || batch->objects.size() >= batch_size) {
+                    flush();
+                }
+            }
+
+            /**
+            * Draw the cells of a location grid directly into the pixels
+            * of a palette image. This is much faster than calling
+            * gdImageSetPixel() for each cell. Returns the number of cells.
+            */
+            static int rasterize(gdImagePtr im, const LocationGrid &grid, int color, LocationGrid::bitset_t &location_all) {
+                int count = 0;
+                for (int n = grid.next(0); n >= 0; n = grid.next(n+1)) {
+                    im->pixels[n / LocationGrid::x_size][n % LocationGrid::x_size] = color;
+                    location_all[n] = true;
+                    count++;
+                }
+                return count;
+            }
+
+            /**
+            * Renderer thread: Takes the next key not yet rendered, draws
+            * its location image, encodes it as PNG and queues it for the
+            * database writer until all keys are done.
+            */
+            void render_images(ImageRendering *r) {
+                LocationGrid::bitset_t location_all;
+                int dense_grids = 0;
+                uint64_t grids_memory = 0;
+
+                const StringStore::string_id_t max_key_id = key_store->get_max_id();
+
+                std::unique_lock<std::mutex> lock(r->mutex);
+                while (r->next_key_id < max_key_id) {
+                    const StringStore::string_id_t key_id = r->next_key_id++;
+                    ObjectTagStat *stat = find_stat(key_id);
+                    if (! stat) {
+                        continue;
+                    }
+                    lock.unlock();
 
                     gdImagePtr im = gdImageCreate(Osmium::ObjectTagStat::location_image_x_size, Osmium::ObjectTagStat::location_image_y_size);
                     int bgColor = gdImageColorAllocate(im, 0, 0, 0);
                     gdImageColorTransparent(im, bgColor);
                     int fgColor = gdImageColorAllocate(im, 180, 0, 0);
 
-                    int n=0;
-                    for (int y=0; y < Osmium::ObjectTagStat::location_image_y_size; y++) {
-                        for (int x=0; x < Osmium::ObjectTagStat::location_image_x_size; x++) {
-                            if (stat->location[n]) {
-                                stat->grids++;
-                                gdImageSetPixel(im, x, y, fgColor);
-                                location_all[n] = true;
-                            }
-                            n++;
-                        }
+                    stat->grids = rasterize(im, stat->location, fgColor, location_all);
+                    if (stat->location.is_dense()) {
+                        dense_grids++;
+                    }
+                    grids_memory += stat->location.memory_usage();
+
+                    LocationPng png;
+                    png.key = key_store->get(key_id);
+                    png.data = gdImagePngPtr(im, &png.size);
+                    gdImageDestroy(im);
+
+                    lock.lock();
+                    while (r->queue.size() >= max_png_queue_size) {
+                        r->not_full.wait(lock);
+                    }
+                    r->queue.push_back(png);
+                    r->not_empty.notify_one();
+                }
+
+                r->location_all |= location_all;
+                r->dense_grids  += dense_grids;
+                r->grids_memory += grids_memory;
+                r->running--;
+                r->not_empty.notify_one();
+            }
+
+            /**
+            * Write the location images of all keys and one with the
+            * locations of all keys to the database. The images are
+            * rendered and PNG-encoded in parallel (one thread per worker),
+            * this thread only writes them to the database.
+            */
+            void print_images() {
+                ImageRendering r;
+                r.next_key_id = 0;
+                r.running = std::max(workers.size(), size_t(1));
+                r.dense_grids = 0;
+                r.grids_memory = 0;
+
+                std::vector<std::thread> renderers;
+                for (unsigned int i=0; i < r.running; i++) {
+                    renderers.push_back(std::thread(&TagStats::render_images, this, &r));
+                }
+
+                Sqlite::Statement *statement_insert_into_key_distributions = db->prepare("INSERT INTO key_distributions (key, png) VALUES (?, ?);");
+                db->begin_transaction();
+
+                int sum_size=0;
+                std::unique_lock<std::mutex> lock(r.mutex);
+                while (true) {
+                    while (r.queue.empty() && r.running > 0) {
+                        r.not_empty.wait(lock);
+                    }
+                    if (r.queue.empty()) {
+                        break;
                     }
+                    LocationPng png = r.queue.front();
+                    r.queue.pop_front();
+                    r.not_full.notify_one();
+                    lock.unlock();
 
-                    int size;
-                    void *ptr = gdImagePngPtr(im, &size);
-                    sum_size += size;
+                    sum_size += png.size;
                     statement_insert_into_key_distributions
-                        ->bind_text(key)
-                        ->bind_blob(ptr, size)
+                        ->bind_text(png.key)
+                        ->bind_blob(png.data, png.size)
                         ->execute();
-                    gdFree(ptr);
+                    gdFree(png.data);
 
-                    gdImageDestroy(im);
+                    lock.lock();
+                }
+                lock.unlock();
+
+                for (std::vector<std::thread>::iterator it = renderers.begin(); it != renderers.end(); it++) {
+                    it->join();
                 }
 
                 gdImagePtr im_all = gdImageCreate(Osmium::ObjectTagStat::location_image_x_size, Osmium::ObjectTagStat::location_image_y_size);
                 gdImageColorAllocate(im_all, 0, 0, 0);
                 int white_all = gdImageColorAllocate(im_all, 255, 255, 255);
-                int n=0, count_grid=0;
-                for (int y=0; y < Osmium::ObjectTagStat::location_image_y_size; y++) {
-                    for (int x=0; x < Osmium::ObjectTagStat::location_image_x_size; x++) {
-                        if (location_all[n]) {
-                            gdImageSetPixel(im_all, x, y, white_all);
-                            count_grid++;
-                        }
-                        n++;
+                for (int n=0; n < LocationGrid::num_cells; n++) {
+                    if (r.location_all[n]) {
+                        im_all->pixels[n / LocationGrid::x_size][n % LocationGrid::x_size] = white_all;
                     }
                 }
-                std::cerr << "grids_all: " << count_grid << "\n";
+                std::cerr << "grids_all: " << r.location_all.count() << "\n";
 
                 int size;
                 void *ptr = gdImagePngPtr(im_all, &size);
@@ -255,16 +998,24 @@ namespace Osmium {
                 gdImageDestroy(im_all);
 
                 std::cerr << "sum of location image sizes: " << sum_size + size << "\n";
+                std::cerr << "location grids: dense=" << r.dense_grids << " memory=" << r.grids_memory / 1024 << "kB\n";
 
                 db->commit();
+                delete statement_insert_into_key_distributions;
             }
 
-            void print_memory_usage() {
-                std::cerr << "string_store: chunk_size=" << string_store->get_chunk_size() / 1024 / 1024 << "MB"
-                          <<                  " chunks=" << string_store->get_chunk_count()
-                          <<                  " memory=" << (string_store->get_chunk_size() / 1024 / 1024) * string_store->get_chunk_count() << "MB"
-                          <<           " bytes_in_last=" << string_store->get_used_bytes_in_last_chunk() / 1024 << "kB"
+            void print_string_store_usage(const char *name, StringStore *store) {
+                std::cerr << name << ": chunk_size=" << store->get_chunk_size() / 1024 << "kB"
+                          <<          " chunks=" << store->get_chunk_count()
+                          <<         " strings=" << store->get_string_count()
+                          <<      " bytes_used=" << store->get_used_bytes() / 1024 << "kB"
+                          <<          " memory=" << store->get_memory_usage() / 1024 / 1024 << "MB"
                           << "\n";
+            }
+
+            void print_memory_usage() {
+                print_string_store_usage("key_store", key_store);
+                print_string_store_usage("value_store", value_store);
 
                 std::cerr << "sizeof(ObjectTagStat)=" << sizeof(ObjectTagStat) << "\n";
 
@@ -295,10 +1046,18 @@ namespace Osmium {
             }
 
             void callback_after_nodes() {
+                wait_for_workers();
                 timer_info("processing nodes");
                 print_memory_usage();
+                if (!way_locations) {
+                    dump_images();
+                }
+            }
+
+            void dump_images() {
                 timer = time(0);
                 print_images();
+                images_dumped = true;
                 timer_info("dumping images");
                 print_memory_usage();
             }
@@ -308,8 +1067,12 @@ namespace Osmium {
             }
 
             void callback_after_ways() {
+                wait_for_workers();
                 timer_info("processing ways");
                 print_memory_usage();
+                if (way_locations) {
+                    dump_images();
+                }
             }
 
             void callback_before_relations() {
@@ -317,81 +1080,263 @@ namespace Osmium {
             }
 
             void callback_after_relations() {
+                wait_for_workers();
                 timer_info("processing relations");
             }
 
             void callback_init() {
+                unlink("taginfo-db.db");
                 db = new Sqlite::Database("taginfo-db.db");
+                db->optimize_for_bulk_load();
+                create_table(db, "source");
+                db->exec("INSERT INTO source (data_until) VALUES (NULL);");
+                create_table(db, "keys");
+                create_table(db, "tags");
+                create_table(db, "keypairs");
+                create_table(db, "key_distributions");
 
                 std::cerr << "sizeof(counter_t) = " << sizeof(counter_t) << "\n";
                 std::cerr << "sizeof(value_hash_map) = " << sizeof(value_hash_map) << "\n";
                 std::cerr << "sizeof(user_hash_map) = " << sizeof(user_hash_map) << "\n";
-                std::cerr << "sizeof(std::bitset<x_size*y_size>) = " << sizeof(std::bitset<Osmium::ObjectTagStat::location_image_x_size * Osmium::ObjectTagStat::location_image_y_size>) << "\n";
+                std::cerr << "sizeof(LocationGrid::bitset_t) = " << sizeof(LocationGrid::bitset_t) << "\n";
                 std::cerr << "sizeof(ObjectTagStat) = " << sizeof(ObjectTagStat) << "\n\n";
 
                 print_memory_usage();
                 std::cerr << "init done\n\n";
             }
 
+            void print_shard_usage() {
+                counter_t all;
+                memset(&all, 0, sizeof(all));
+                for (std::vector<Shard *>::const_iterator it = shards.begin(); it != shards.end(); it++) {
+                    all.add((*it)->tags);
+                }
+
+                std::cerr << "tags counted: all=" << all.by_type.all
+                          <<            " nodes=" << all.by_type.nodes
+                          <<             " ways=" << all.by_type.ways
+                          <<        " relations=" << all.by_type.relations
+                          << "\n";
+
+                if (shards.size() > 1) {
+                    for (unsigned int i=0; i < shards.size(); i++) {
+                        std::cerr << "  shard " << i << ": " << shards[i]->tags.by_type.all << " tags ("
+                                  << (all.by_type.all ? 100 * uint64_t(shards[i]->tags.by_type.all) / all.by_type.all : 0) << "%)\n";
+                    }
+                }
+            }
+
+            /// orders string ids (or pairs with a string id as first) by their strings
+            class StringOrder {
+
+                const StringStore *store;
+
+            public:
+
+                StringOrder(const StringStore *store) : store(store) {
+                }
+
+                bool operator()(StringStore::string_id_t a, StringStore::string_id_t b) const {
+                    return strcmp(store->get(a), store->get(b)) < 0;
+                }
+
+                bool operator()(const value_hash_map::value_type *a, const value_hash_map::value_type *b) const {
+                    return (*this)(a->first, b->first);
+                }
+
+            }; // class StringOrder
+
+            /// orders key pairs by the strings of their first and then their second key
+            class KeyPairOrder {
+
+                const StringStore *store;
+
+            public:
+
+                KeyPairOrder(const StringStore *store) : store(store) {
+                }
+
+                bool operator()(const KeyPairTable::entry_t *a, const KeyPairTable::entry_t *b) const {
+                    const int cmp = strcmp(store->get(KeyPairTable::first(a->pair)), store->get(KeyPairTable::first(b->pair)));
+                    if (cmp != 0) {
+                        return cmp < 0;
+                    }
+                    return strcmp(store->get(KeyPairTable::second(a->pair)), store->get(KeyPairTable::second(b->pair))) < 0;
+                }
+
+            }; // class KeyPairOrder
+
+            /**
+            * Create one of the tables of the taginfo database. They don't
+            * have any indexes until all rows are inserted, see
+            * create_indexes().
+            */
+            static void create_table(Sqlite::Database *database, const char *table) {
+                static const char *schema[][2] = {
+                    { "source", "CREATE TABLE source (data_until TEXT);" },
+                    { "keys", "CREATE TABLE keys (key TEXT, " \
+                        " count_all INTEGER,  count_nodes INTEGER,  count_ways INTEGER,  count_relations INTEGER, " \
+                        "values_all INTEGER, values_nodes INTEGER, values_ways INTEGER, values_relations INTEGER, " \
+                        " users_all INTEGER,  users_nodes INTEGER,  users_ways INTEGER,  users_relations INTEGER, " \
+                        "grids INTEGER);" },
+                    { "tags", "CREATE TABLE tags (key TEXT, value TEXT, " \
+                        "count_all INTEGER, count_nodes INTEGER, count_ways INTEGER, count_relations INTEGER);" },
+                    { "keypairs", "CREATE TABLE keypairs (key1 TEXT, key2 TEXT, " \
+                        "count_all INTEGER, count_nodes INTEGER, count_ways INTEGER, count_relations INTEGER);" },
+                    { "key_distributions", "CREATE TABLE key_distributions (key TEXT, png BLOB);" },
+                    { NULL, NULL }
+                };
+                for (int i=0; schema[i][0]; i++) {
+                    if (!strcmp(schema[i][0], table)) {
+                        database->exec(schema[i][1]);
+                        return;
+                    }
+                }
+                throw std::invalid_argument(std::string("unknown table: ") + table);
+            }
+
+            /// create all indexes, this is much faster after the rows are inserted
+            void create_indexes() {
+                db->exec("CREATE UNIQUE INDEX keys_key_idx ON keys (key);");
+                db->exec("CREATE UNIQUE INDEX tags_key_value_idx ON tags (key, value);");
+                db->exec("CREATE UNIQUE INDEX keypairs_key1_key2_idx ON keypairs (key1, key2);");
+                db->exec("CREATE INDEX keypairs_key2_idx ON keypairs (key2);");
+                db->exec("CREATE INDEX key_distributions_key_idx ON key_distributions (key);");
+            }
+
+            /// name of the database file a table is written to with separate_table_dbs
+            static std::string table_db_filename(const char *table) {
+                return std::string("taginfo-db-") + table + ".db";
+            }
+
+            /// create the database file for one table and start a writer for it
+            static Sqlite::AsyncWriter *open_table_db(const char *table, std::vector<Sqlite::Database *> &table_dbs) {
+                const std::string filename = table_db_filename(table);
+                unlink(filename.c_str());
+                Sqlite::Database *table_db = new Sqlite::Database(filename.c_str());
+                table_db->optimize_for_bulk_load();
+                create_table(table_db, table);
+                table_dbs.push_back(table_db);
+                return new Sqlite::AsyncWriter(table_db);
+            }
+
+            /// copy a table from its own database file into taginfo-db.db and remove the file
+            void merge_table_db(const char *table) {
+                const std::string filename = table_db_filename(table);
+                const std::string sql = "ATTACH DATABASE '" + filename + "' AS part; " +
+                                        "INSERT INTO main." + table + " SELECT * FROM part." + table + "; " +
+                                        "DETACH DATABASE part;";
+                db->exec(sql.c_str());
+                unlink(filename.c_str());
+            }
+
             void callback_final() {
+                wait_for_workers();
+
+                // the parsers only call callback_after_nodes()/callback_after_ways()
+                // when objects of the next type follow
+                if (!images_dumped) {
+                    dump_images();
+                }
+
+                stop_workers();
+                print_shard_usage();
                 print_memory_usage();
                 timer = time(0);
 
-                Sqlite::Statement *statement_insert_into_keys = db->prepare("INSERT INTO keys (key, " \
+                // The rows are written in other threads while the statistics are collected
+                // here. With separate_table_dbs each table goes into a database file of its
+                // own, so the tables are written in parallel.
+                Sqlite::AsyncWriter writer(db);
+                std::vector<Sqlite::Database *> table_dbs;
+                Sqlite::AsyncWriter *keys_writer     = separate_table_dbs ? open_table_db("keys",     table_dbs) : &writer;
+                Sqlite::AsyncWriter *tags_writer     = separate_table_dbs ? open_table_db("tags",     table_dbs) : &writer;
+                Sqlite::AsyncWriter *keypairs_writer = separate_table_dbs ? open_table_db("keypairs", table_dbs) : &writer;
+
+                Sqlite::AsyncWriter::Statement *statement_insert_into_keys = keys_writer->prepare("INSERT INTO keys (key, " \
                     " count_all,  count_nodes,  count_ways,  count_relations, " \
                     "values_all, values_nodes, values_ways, values_relations, " \
                     " users_all,  users_nodes,  users_ways,  users_relations, " \
                     "grids) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);");
 
-                Sqlite::Statement *statement_insert_into_tags = db->prepare("INSERT INTO tags (key, value, " \
+                Sqlite::AsyncWriter::Statement *statement_insert_into_tags = tags_writer->prepare("INSERT INTO tags (key, value, " \
                     "count_all, count_nodes, count_ways, count_relations) " \
                     "VALUES (?, ?, ?, ?, ?, ?);");
 
-                Sqlite::Statement *statement_insert_into_keypairs = db->prepare("INSERT INTO keypairs (key1, key2, " \
+                Sqlite::AsyncWriter::Statement *statement_insert_into_keypairs = keypairs_writer->prepare("INSERT INTO keypairs (key1, key2, " \
                     "count_all, count_nodes, count_ways, count_relations) " \
                     "VALUES (?, ?, ?, ?, ?, ?);");
 
-                Sqlite::Statement *statement_update_meta = db->prepare("UPDATE source SET data_until=(date(?) || ' ' || time(?))");
+                Sqlite::AsyncWriter::Statement *statement_update_meta = writer.prepare("UPDATE source SET data_until=(date(?) || ' ' || time(?))");
 
-                db->begin_transaction();
+                char max_timestamp_str[Osmium::Timestamp::max_length] = "";
+                if (max_timestamp != 0) {
+                    Osmium::Timestamp::to_iso(max_timestamp, max_timestamp_str);
+                }
+                statement_update_meta->bind_text(max_timestamp_str)->bind_text(max_timestamp_str)->execute();
 
-                statement_update_meta->bind_text(max_timestamp)->bind_text(max_timestamp)->execute();
+                const StringStore::string_id_t max_key_id = key_store->get_max_id();
 
-                uint64_t tags_hash_map_size=tags_stat.size();
-                uint64_t tags_hash_map_buckets=tags_stat.size()*2; //bucket_count();
+                uint64_t tags_hash_map_size=0;
+                uint64_t tags_hash_map_buckets=max_key_id;
 
                 uint64_t values_hash_map_size=0;
                 uint64_t values_hash_map_buckets=0;
 
                 uint64_t keypairs_hash_map_size=0;
                 uint64_t keypairs_hash_map_buckets=0;
+                uint64_t keypairs_memory=0;
 
                 uint64_t users_hash_map_size=0;
                 uint64_t users_hash_map_buckets=0;
 
-                for (tags_iterator = tags_stat.begin(); tags_iterator != tags_stat.end(); tags_iterator++) {
-                    ObjectTagStat *stat = tags_iterator->second;
-    
+                uint64_t users_estimate_count=0;
+
+                // all rows are inserted sorted by their (later) index, so the b-trees are built in order
+                std::vector<StringStore::string_id_t> key_ids;
+                for (StringStore::string_id_t key_id=0; key_id < max_key_id; key_id++) {
+                    if (find_stat(key_id)) {
+                        key_ids.push_back(key_id);
+                    }
+                }
+                std::sort(key_ids.begin(), key_ids.end(), StringOrder(key_store));
+
+                std::vector<const value_hash_map::value_type *> values;
+                for (std::vector<StringStore::string_id_t>::const_iterator key_id = key_ids.begin(); key_id != key_ids.end(); key_id++) {
+                    ObjectTagStat *stat = find_stat(*key_id);
+                    const char *key = key_store->get(*key_id);
+                    tags_hash_map_size++;
+
                     values_hash_map_size    += stat->values_stat.size();
                     values_hash_map_buckets += stat->values_stat.bucket_count();
 
-                    for (values_iterator = stat->values_stat.begin(); values_iterator != stat->values_stat.end(); values_iterator++) {
+                    values.clear();
+                    for (value_hash_map::const_iterator values_iterator = stat->values_stat.begin(); values_iterator != stat->values_stat.end(); values_iterator++) {
+                        values.push_back(&*values_iterator);
+                    }
+                    std::sort(values.begin(), values.end(), StringOrder(value_store));
+
+                    for (std::vector<const value_hash_map::value_type *>::const_iterator value = values.begin(); value != values.end(); value++) {
                         statement_insert_into_tags
-                            ->bind_text(tags_iterator->first)
-                            ->bind_text(values_iterator->first)
-                            ->bind_int64(values_iterator->second.by_type.all)
-                            ->bind_int64(values_iterator->second.by_type.nodes)
-                            ->bind_int64(values_iterator->second.by_type.ways)
-                            ->bind_int64(values_iterator->second.by_type.relations)
+                            ->bind_text(key)
+                            ->bind_text(value_store->get((*value)->first))
+                            ->bind_int64((*value)->second.by_type.all)
+                            ->bind_int64((*value)->second.by_type.nodes)
+                            ->bind_int64((*value)->second.by_type.ways)
+                            ->bind_int64((*value)->second.by_type.relations)
                             ->execute();
                     }
 
-                    stat->users.by_type.all = stat->users_stat.size();
-                    users_hash_map_size    += stat->users.by_type.all;
-                    users_hash_map_buckets += stat->users_stat.bucket_count();
+                    stat->count_users();
+                    if (stat->users_stat) {
+                        users_hash_map_size    += stat->users_stat->size();
+                        users_hash_map_buckets += stat->users_stat->bucket_count();
+                    } else {
+                        users_estimate_count++;
+                    }
 
                     statement_insert_into_keys
-                        ->bind_text(tags_iterator->first)
+                        ->bind_text(key)
                         ->bind_int64(stat->key.by_type.all)
                         ->bind_int64(stat->key.by_type.nodes)
                         ->bind_int64(stat->key.by_type.ways)
@@ -407,39 +1352,71 @@ namespace Osmium {
                         ->bind_int64(stat->grids)
                         ->execute();
 
-                    keypairs_hash_map_size    += stat->keypairs_stat.size();
-                    keypairs_hash_map_buckets += stat->keypairs_stat.bucket_count();
-
-                    for (values_iterator = stat->keypairs_stat.begin(); values_iterator != stat->keypairs_stat.end(); values_iterator++) {
-                        statement_insert_into_keypairs
-                            ->bind_text(tags_iterator->first)
-                            ->bind_text(values_iterator->first)
-                            ->bind_int64(values_iterator->second.by_type.all)
-                            ->bind_int64(values_iterator->second.by_type.nodes)
-                            ->bind_int64(values_iterator->second.by_type.ways)
-                            ->bind_int64(values_iterator->second.by_type.relations)
-                            ->execute();
+                }
+
+                std::vector<const KeyPairTable::entry_t *> keypairs;
+                for (std::vector<Shard *>::const_iterator shard = shards.begin(); shard != shards.end(); shard++) {
+                    const KeyPairTable &shard_keypairs = (*shard)->keypairs;
+                    keypairs_hash_map_size    += shard_keypairs.size();
+                    keypairs_hash_map_buckets += shard_keypairs.bucket_count();
+                    keypairs_memory           += shard_keypairs.memory_usage();
+
+                    for (std::vector<KeyPairTable::entry_t>::const_iterator it = shard_keypairs.get_entries().begin(); it != shard_keypairs.get_entries().end(); it++) {
+                        keypairs.push_back(&*it);
                     }
                 }
+                std::sort(keypairs.begin(), keypairs.end(), KeyPairOrder(key_store));
+
+                for (std::vector<const KeyPairTable::entry_t *>::const_iterator it = keypairs.begin(); it != keypairs.end(); it++) {
+                    statement_insert_into_keypairs
+                        ->bind_text(key_store->get(KeyPairTable::first((*it)->pair)))
+                        ->bind_text(key_store->get(KeyPairTable::second((*it)->pair)))
+                        ->bind_int64((*it)->counter.by_type.all)
+                        ->bind_int64((*it)->counter.by_type.nodes)
+                        ->bind_int64((*it)->counter.by_type.ways)
+                        ->bind_int64((*it)->counter.by_type.relations)
+                        ->execute();
+                }
 
-                db->commit();
-                db->close();
+                writer.finish();
+                if (separate_table_dbs) {
+                    keys_writer->finish();
+                    tags_writer->finish();
+                    keypairs_writer->finish();
+                    delete keys_writer;
+                    delete tags_writer;
+                    delete keypairs_writer;
+                    for (std::vector<Sqlite::Database *>::iterator it = table_dbs.begin(); it != table_dbs.end(); it++) {
+                        delete *it;
+                    }
+                    merge_table_db("keys");
+                    merge_table_db("tags");
+                    merge_table_db("keypairs");
+                }
                 timer_info("dumping to db");
 
+                timer = time(0);
+                create_indexes();
+                db->close();
+                timer_info("creating indexes");
+
                 std::cerr << "\nhash map sizes:\n";
                 std::cerr << "  tags:     size=" <<     tags_hash_map_size << " buckets=" <<     tags_hash_map_buckets << " sizeof(ObjectTagStat)=" << sizeof(ObjectTagStat) << " *=" <<     tags_hash_map_size * sizeof(ObjectTagStat) << "\n";
                 std::cerr << "  values:   size=" <<   values_hash_map_size << " buckets=" <<   values_hash_map_buckets << " sizeof(counter_t)="     << sizeof(counter_t)     << " *=" <<   values_hash_map_size * sizeof(counter_t) << "\n";
-                std::cerr << "  keypairs: size=" << keypairs_hash_map_size << " buckets=" << keypairs_hash_map_buckets << " sizeof(counter_t)="     << sizeof(counter_t)     << " *=" << keypairs_hash_map_size * sizeof(counter_t) << "\n";
+                std::cerr << "  keypairs: size=" << keypairs_hash_map_size << " buckets=" << keypairs_hash_map_buckets << " sizeof(entry_t)="       << sizeof(KeyPairTable::entry_t) << " *=" << keypairs_hash_map_size * sizeof(KeyPairTable::entry_t) << "\n";
                 std::cerr << "  users:    size=" <<    users_hash_map_size << " buckets=" <<    users_hash_map_buckets << " sizeof(uint32_t)="      << sizeof(uint32_t)      << " *=" <<    users_hash_map_size * sizeof(uint32_t) << "\n";
-                std::cerr << "  sum: " << tags_hash_map_size * sizeof(ObjectTagStat) + values_hash_map_size * sizeof(counter_t) + keypairs_hash_map_size * sizeof(counter_t) + users_hash_map_size * sizeof(uint32_t) << "\n";
+                std::cerr << "  sum: " << tags_hash_map_size * sizeof(ObjectTagStat) + values_hash_map_size * sizeof(counter_t) + keypairs_hash_map_size * sizeof(KeyPairTable::entry_t) + users_hash_map_size * sizeof(uint32_t) << "\n";
 
                 std::cerr << "\ntotal memory for hashes:\n";
                 std::cerr << "  (sizeof(hash key) + sizeof(hash value *) + 2.5 bit overhead) * bucket_count + sizeof(hash value) * size \n";
-                std::cerr << " tags:     " << ((sizeof(const char*)*8 + sizeof(ObjectTagStat *)*8 + 3) * tags_hash_map_buckets / 8 ) + sizeof(ObjectTagStat) * tags_hash_map_size << "\n";
+                std::cerr << " tags:     " << (sizeof(ObjectTagStat *) * tags_hash_map_buckets) + sizeof(ObjectTagStat) * tags_hash_map_size << "\n";
                 std::cerr << "  (sizeof(hash key) + sizeof(hash value  ) + 2.5 bit overhead) * bucket_count\n";
-                std::cerr << " values:   " << ((sizeof(const char*)*8 + sizeof(counter_t)*8 + 3) * values_hash_map_buckets / 8 ) << "\n";
-                std::cerr << " keypairs: " << ((sizeof(const char*)*8 + sizeof(counter_t)*8 + 3) * keypairs_hash_map_buckets / 8 ) << "\n";
+                std::cerr << " values:   " << ((sizeof(StringStore::string_id_t)*8 + sizeof(counter_t)*8 + 3) * values_hash_map_buckets / 8 ) << "\n";
+                std::cerr << " keypairs: " << keypairs_memory << "\n";
                 std::cerr << " users:    " << ((sizeof(osm_user_id_t)*8 + sizeof(uint32_t)*8 + 3) * users_hash_map_buckets / 8 )  << "\n";
+                if (users_precision) {
+                    std::cerr << " users estimated for " << users_estimate_count << " keys: " << users_estimate_count * 4 * (uint64_t(1) << users_precision) << "\n";
+                }
                 std::cerr << "\n";
 
                 print_memory_usage();
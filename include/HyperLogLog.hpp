@@ -0,0 +1,117 @@
+#ifndef OSMIUM_HYPERLOGLOG_HPP
+#define OSMIUM_HYPERLOGLOG_HPP
+
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+#include <stdint.h>
+
+namespace Osmium {
+
+    /**
+    *
+    * HyperLogLog sketch for estimating the number of distinct items (for
+    * instance user ids) with a fixed amount of memory: 2^precision bytes.
+    * The relative standard error is about 1.04 / sqrt(2^precision), so
+    * 1.6% with the default precision of 12 (4kB).
+    *
+    * See Flajolet et al., "HyperLogLog: the analysis of a near-optimal
+    * cardinality estimation algorithm" (2007). Small cardinalities are
+    * estimated with linear counting. Because a 64 bit hash is used, no
+    * correction for large cardinalities is needed.
+    *
+    */
+    class HyperLogLog {
+
+        int precision;
+        std::vector<uint8_t> registers;
+
+        /// finalizer of splitmix64, spreads the bits of small integers like ids over the whole hash
+        static uint64_t hash(uint64_t x) {
+            x ^= x >> 30;
+            x *= 0xbf58476d1ce4e5b9ULL;
+            x ^= x >> 27;
+            x *= 0x94d049bb133111ebULL;
+            x ^= x >> 31;
+            return x;
+        }
+
+      public:
+
+        static const int min_precision = 4;
+        static const int max_precision = 16;
+
+        HyperLogLog(int precision=12) : precision(precision), registers() {
+            if (precision < min_precision || precision > max_precision) {
+                throw std::invalid_argument("HyperLogLog precision must be between 4 and 16");
+            }
+            registers.resize(1 << precision, 0);
+        }
+
+        void add(uint64_t item) {
+            const uint64_t h = hash(item);
+            const uint64_t index = h >> (64 - precision);
+
+            // rank = position of the first 1 bit in the remaining bits
+            uint64_t w = h << precision;
+            uint8_t rank = 1;
+            while (rank <= 64 - precision && !(w & (1ULL << 63))) {
+                rank++;
+                w <<= 1;
+            }
+
+            if (rank > registers[index]) {
+                registers[index] = rank;
+            }
+        }
+
+        /// add all items from another sketch with the same precision
+        void merge(const HyperLogLog &other) {
+            if (other.precision != precision) {
+                throw std::invalid_argument("can only merge HyperLogLog sketches with same precision");
+            }
+            for (unsigned int i=0; i < registers.size(); i++) {
+                if (other.registers[i] > registers[i]) {
+                    registers[i] = other.registers[i];
+                }
+            }
+        }
+
+        uint64_t estimate() const {
+            const double m = registers.size();
+
+            double sum = 0;
+            int zeros = 0;
+            for (unsigned int i=0; i < registers.size(); i++) {
+                sum += std::ldexp(1.0, -registers[i]);
+                if (registers[i] == 0) {
+                    zeros++;
+                }
+            }
+
+            double alpha;
+            switch (registers.size()) {
+                case 16: alpha = 0.673; break;
+                case 32: alpha = 0.697; break;
+                case 64: alpha = 0.709; break;
+                default: alpha = 0.7213 / (1 + 1.079 / m);
+            }
+
+            double e = alpha * m * m / sum;
+            if (e <= 2.5 * m && zeros > 0) {
+                e = m * std::log(m / zeros);
+            }
+
+            return uint64_t(e + 0.5);
+        }
+
+        /// memory used by the registers in bytes
+        size_t memory_usage() const {
+            return registers.size();
+        }
+
+    }; // class HyperLogLog
+
+} // namespace Osmium
+
+#endif // OSMIUM_HYPERLOGLOG_HPP
@@ -0,0 +1,112 @@
+#ifndef OSMIUM_IDBITMAP_HPP
+#define OSMIUM_IDBITMAP_HPP
+
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+
+namespace Osmium {
+
+    /**
+    * Set of ids (for instance user or node ids) as a bitmap, one bit
+    * for each possible id. The bitmap is allocated in chunks of 4M ids
+    * (512kB) when the first id in a chunk is set, so ranges of ids that
+    * are never used don't need any memory.
+    */
+    class IdBitmap {
+
+        static const int chunk_bits = 22;
+        static const uint64_t ids_per_chunk = uint64_t(1) << chunk_bits;
+        static const uint64_t words_per_chunk = ids_per_chunk / 64;
+
+        std::vector<uint64_t *> chunks;
+
+        IdBitmap(const IdBitmap &);
+        IdBitmap &operator=(const IdBitmap &);
+
+      public:
+
+        IdBitmap() : chunks() {
+        }
+
+        ~IdBitmap() {
+            clear();
+        }
+
+        void set(uint64_t id) {
+            const uint64_t chunk = id >> chunk_bits;
+            if (chunk >= chunks.size()) {
+                chunks.resize(chunk + 1, NULL);
+            }
+            if (!chunks[chunk]) {
+                chunks[chunk] = new uint64_t[words_per_chunk];
+                memset(chunks[chunk], 0, words_per_chunk * sizeof(uint64_t));
+            }
+            const uint64_t bit = id & (ids_per_chunk - 1);
+            chunks[chunk][bit / 64] |= uint64_t(1) << (bit % 64);
+        }
+
+        bool get(uint64_t id) const {
+            const uint64_t chunk = id >> chunk_bits;
+            if (chunk >= chunks.size() || !chunks[chunk]) {
+                return false;
+            }
+            const uint64_t bit = id & (ids_per_chunk - 1);
+            return (chunks[chunk][bit / 64] >> (bit % 64)) & 1;
+        }
+
+        uint64_t count() const {
+            uint64_t n = 0;
+            for (std::vector<uint64_t *>::const_iterator it = chunks.begin(); it != chunks.end(); it++) {
+                if (*it) {
+                    for (uint64_t i=0; i < words_per_chunk; i++) {
+                        n += __builtin_popcountll((*it)[i]);
+                    }
+                }
+            }
+            return n;
+        }
+
+        /// add all ids set in the other bitmap
+        void merge(const IdBitmap &other) {
+            if (other.chunks.size() > chunks.size()) {
+                chunks.resize(other.chunks.size(), NULL);
+            }
+            for (unsigned int c=0; c < other.chunks.size(); c++) {
+                if (!other.chunks[c]) {
+                    continue;
+                }
+                if (!chunks[c]) {
+                    chunks[c] = new uint64_t[words_per_chunk];
+                    memcpy(chunks[c], other.chunks[c], words_per_chunk * sizeof(uint64_t));
+                } else {
+                    for (uint64_t i=0; i < words_per_chunk; i++) {
+                        chunks[c][i] |= other.chunks[c][i];
+                    }
+                }
+            }
+        }
+
+        void clear() {
+            for (std::vector<uint64_t *>::iterator it = chunks.begin(); it != chunks.end(); it++) {
+                delete[] *it;
+            }
+            chunks.clear();
+        }
+
+        /// memory used by the bitmap in bytes
+        size_t memory_usage() const {
+            size_t size = chunks.capacity() * sizeof(uint64_t *);
+            for (std::vector<uint64_t *>::const_iterator it = chunks.begin(); it != chunks.end(); it++) {
+                if (*it) {
+                    size += words_per_chunk * sizeof(uint64_t);
+                }
+            }
+            return size;
+        }
+
+    }; // class IdBitmap
+
+} // namespace Osmium
+
+#endif // OSMIUM_IDBITMAP_HPP
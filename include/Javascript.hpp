@@ -15,6 +15,12 @@ namespace Osmium {
 
                 Osmium::OSM::Object *object;
 
+                /// generation of the object the cached values were made for
+                unsigned int cache_generation;
+
+                /// all tags as plain Javascript object, made on first use
+                v8::Persistent<v8::Object> js_tags_object;
+
                 public:
 
                 v8::Local<v8::Object> js_object_instance;
@@ -26,15 +32,47 @@ namespace Osmium {
 
                 protected:
 
-                Wrapper() {
+                Wrapper() : cache_generation(0) {
+                }
+
+                /**
+                * Drop the cached values if the object was reset since
+                * they were made. Call before using any cached value.
+                */
+                void check_cache() {
+                    const unsigned int generation = get_object()->generation;
+                    if (cache_generation != generation) {
+                        clear_cache();
+                        cache_generation = generation;
+                    }
+                }
+
+                /// free all cached values, derived classes with caches of their own must extend this
+                virtual void clear_cache() {
+                    if (!js_tags_object.IsEmpty()) {
+                        js_tags_object.Dispose();
+                        js_tags_object.Clear();
+                    }
                 }
 
                 public:
 
+                virtual ~Wrapper() {
+                    clear_cache();
+                }
+
                 v8::Local<v8::Object> get_instance() {
                     return js_object_instance;
                 }
 
+                v8::Local<v8::Object> get_tags_object() {
+                    check_cache();
+                    if (js_tags_object.IsEmpty()) {
+                        js_tags_object = v8::Persistent<v8::Object>::New(Osmium::Javascript::Template::create_tags_object(get_object()));
+                    }
+                    return v8::Local<v8::Object>::New(js_tags_object);
+                }
+
             }; // class Wrapper
 
         } // namespace Object
@@ -58,6 +96,7 @@ namespace Osmium {
                 }
 
                 ~Wrapper() {
+                    clear_cache();
                     delete object;
                 }
 
@@ -80,6 +119,28 @@ namespace Osmium {
                 v8::Local<v8::Object> js_nodes_instance;
                 v8::Local<v8::Object> js_geom_instance;
 
+                private:
+
+                // cached values for the current way, made on first use
+                v8::Persistent<v8::Array>  js_node_indexes;
+                v8::Persistent<v8::String> js_linestring_wkt;
+
+                protected:
+
+                void clear_cache() {
+                    Osmium::Javascript::Object::Wrapper::clear_cache();
+                    if (!js_node_indexes.IsEmpty()) {
+                        js_node_indexes.Dispose();
+                        js_node_indexes.Clear();
+                    }
+                    if (!js_linestring_wkt.IsEmpty()) {
+                        js_linestring_wkt.Dispose();
+                        js_linestring_wkt.Clear();
+                    }
+                }
+
+                public:
+
                 Wrapper() : Osmium::Javascript::Object::Wrapper() {
                     object = new Osmium::OSM::Way;
                     object->wrapper = this;
@@ -91,6 +152,7 @@ namespace Osmium {
                 }
 
                 ~Wrapper() {
+                    clear_cache();
                     delete object;
                 }
 
@@ -98,6 +160,39 @@ namespace Osmium {
                     return object;
                 }
 
+                /// array with the indexes of all nodes (for enumerating the nodes)
+                v8::Local<v8::Array> get_node_indexes() {
+                    check_cache();
+                    if (js_node_indexes.IsEmpty()) {
+                        const osm_sequence_id_t num_nodes = object->node_count();
+                        v8::Local<v8::Array> array = v8::Array::New(num_nodes);
+                        for (osm_sequence_id_t i=0; i < num_nodes; i++) {
+                            v8::Local<v8::Integer> ii = v8::Integer::New(i);
+                            array->Set(ii, ii);
+                        }
+                        js_node_indexes = v8::Persistent<v8::Array>::New(array);
+                    }
+                    return v8::Local<v8::Array>::New(js_node_indexes);
+                }
+
+                v8::Local<v8::String> get_linestring_wkt() {
+                    check_cache();
+                    if (js_linestring_wkt.IsEmpty()) {
+                        const osm_sequence_id_t num_nodes = object->node_count();
+                        std::ostringstream oss;
+                        oss << "LINESTRING(";
+                        for (osm_sequence_id_t i=0; i < num_nodes; i++) {
+                            if (i != 0) {
+                                oss << ",";
+                            }
+                            oss << object->lon[i] << " " << object->lat[i];
+                        }
+                        oss << ")";
+                        js_linestring_wkt = v8::Persistent<v8::String>::New(v8::String::New(oss.str().c_str()));
+                    }
+                    return v8::Local<v8::String>::New(js_linestring_wkt);
+                }
+
             }; // class Wrapper
 
         } // namespace Way
@@ -122,6 +217,7 @@ namespace Osmium {
                 }
 
                 ~Wrapper() {
+                    clear_cache();
                     delete object;
                 }
 
@@ -158,6 +254,7 @@ namespace Osmium {
 
                 void set_object(Osmium::OSM::Multipolygon *o) {
                     //if (object) object->wrapper = NULL;
+                    clear_cache();
                     object = o;
                     object->wrapper = this;
                 }
@@ -37,6 +37,8 @@ namespace Osmium {
 
             v8::Local<v8::Object> create_tags_instance(void *wrapper);
 
+            v8::Local<v8::Object> create_tags_object(Osmium::OSM::Object *object);
+
             v8::Local<v8::Object> create_node_instance(void *wrapper);
 
             v8::Local<v8::Object> create_node_geom_instance(void *wrapper);
@@ -30,7 +30,7 @@ namespace Osmium {
                     v8::HandleScope handle_scope;
 
                     OSM::RelationMember *member = (OSM::RelationMember *) v8::Local<v8::External>::Cast(info.Holder()->GetInternalField(0))->Value();
-                    return v8::String::New(member->role);
+                    return v8::String::New(member->get_role());
                 }
 
             public:
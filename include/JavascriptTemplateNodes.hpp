@@ -24,16 +24,7 @@ namespace Osmium {
                     v8::HandleScope handle_scope;
 
                     Osmium::Javascript::Way::Wrapper *self = (Osmium::Javascript::Way::Wrapper *) v8::Local<v8::External>::Cast(info.Holder()->GetInternalField(0))->Value();
-
-                    const osm_sequence_id_t num_nodes = self->object->node_count();
-                    v8::Local<v8::Array> array = v8::Array::New(num_nodes);
-
-                    for (osm_sequence_id_t i=0; i < num_nodes; i++) {
-                        v8::Local<v8::Integer> ii = v8::Integer::New(i);
-                        array->Set(ii, ii);
-                    }
-
-                    return handle_scope.Close(array);
+                    return handle_scope.Close(self->get_node_indexes());
                 }
 
             public:
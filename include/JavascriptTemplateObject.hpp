@@ -31,7 +31,7 @@ namespace Osmium {
 
                 static v8::Handle<v8::Value> GetUser(v8::Local<v8::String> /*property*/, const v8::AccessorInfo &info) {
                     Osmium::Javascript::Object::Wrapper *self = (Osmium::Javascript::Object::Wrapper *) v8::Local<v8::External>::Cast(info.Holder()->GetInternalField(0))->Value();
-                    return v8::String::New(self->get_object()->user);
+                    return v8::String::New(self->get_object()->get_user());
                 }
 
                 static v8::Handle<v8::Value> GetChangeset(v8::Local<v8::String> /*property*/, const v8::AccessorInfo &info) {
@@ -44,6 +44,13 @@ namespace Osmium {
                     return self->js_tags_instance;
                 }
 
+                static v8::Handle<v8::Value> GetTagsObject(v8::Local<v8::String> /*property*/, const v8::AccessorInfo &info) {
+                    v8::HandleScope handle_scope;
+
+                    Osmium::Javascript::Object::Wrapper *self = (Osmium::Javascript::Object::Wrapper *) v8::Local<v8::External>::Cast(info.Holder()->GetInternalField(0))->Value();
+                    return handle_scope.Close(self->get_tags_object());
+                }
+
             protected:
 
                 Object() : Base(1) {
@@ -54,6 +61,7 @@ namespace Osmium {
                     js_template->SetAccessor(v8::String::New("user"),      GetUser);
                     js_template->SetAccessor(v8::String::New("changeset"), GetChangeset);
                     js_template->SetAccessor(v8::String::New("tags"),      GetTags);
+                    js_template->SetAccessor(v8::String::New("tags_object"), GetTagsObject);
                 }
 
             }; // class Object
@@ -1,6 +1,9 @@
 #ifndef OSMIUM_JAVASCRIPT_TEMPLATE_TAGS_HPP
 #define OSMIUM_JAVASCRIPT_TEMPLATE_TAGS_HPP
 
+#include <map>
+#include <string>
+
 namespace Osmium {
 
     namespace Javascript {
@@ -9,20 +12,27 @@ namespace Osmium {
 
             class Tags : public Base {
 
-                static Osmium::OSM::Object *get_object(const v8::AccessorInfo &info) {
-                    Osmium::Javascript::Object::Wrapper *self = (Osmium::Javascript::Object::Wrapper *) v8::Local<v8::External>::Cast(info.Holder()->GetInternalField(0))->Value();
-                    return self->get_object();
+                /// no more keys than this are kept in key_symbols, so odd keys don't use up memory
+                static const unsigned int max_key_symbols = 4096;
+
+                /// V8 symbols for tag keys, created once and used for all objects
+                std::map<std::string, v8::Persistent<v8::String> > key_symbols;
+
+                static Osmium::Javascript::Object::Wrapper *get_wrapper(const v8::AccessorInfo &info) {
+                    return (Osmium::Javascript::Object::Wrapper *) v8::Local<v8::External>::Cast(info.Holder()->GetInternalField(0))->Value();
                 }
 
+                /**
+                * All properties are looked up in the tags object of the
+                * wrapper, so the value strings are only made once per
+                * object, however often the script reads them.
+                */
                 static v8::Handle<v8::Value> Getter(v8::Local<v8::String> property, const v8::AccessorInfo &info) {
                     v8::HandleScope handle_scope;
 
-                    Osmium::OSM::Object *object = get_object(info);
-
-                    v8::String::Utf8Value key(property);
-                    const char *value = object->get_tag_by_key(*key);
-                    if (value) {
-                        return handle_scope.Close(v8::String::New(value));
+                    v8::Local<v8::Object> tags = get_wrapper(info)->get_tags_object();
+                    if (tags->HasOwnProperty(property)) {
+                        return handle_scope.Close(tags->Get(property));
                     }
                     return v8::Undefined();
                 }
@@ -30,22 +40,56 @@ namespace Osmium {
                 static v8::Handle<v8::Array> Enumerator(const v8::AccessorInfo &info) {
                     v8::HandleScope handle_scope;
 
-                    Osmium::OSM::Object *object = get_object(info);
-
-                    const int num_tags = object->tag_count();
-                    v8::Local<v8::Array> array = v8::Array::New(num_tags);
+                    return handle_scope.Close(get_wrapper(info)->get_tags_object()->GetPropertyNames());
+                }
 
-                    for (int i=0; i < num_tags; i++) {
-                        array->Set(v8::Integer::New(i), v8::String::New(object->get_tag_key(i)));
+                v8::Handle<v8::String> key_symbol(const char *key) {
+                    std::map<std::string, v8::Persistent<v8::String> >::const_iterator it = key_symbols.find(key);
+                    if (it != key_symbols.end()) {
+                        return it->second;
                     }
-
-                    return handle_scope.Close(array);
+                    if (key_symbols.size() < max_key_symbols) {
+                        return key_symbols[key] = v8::Persistent<v8::String>::New(v8::String::NewSymbol(key));
+                    }
+                    return v8::String::New(key);
                 }
 
             public:
 
-                Tags() : Base(1) {
+                Tags() : Base(1), key_symbols() {
                     js_template->SetNamedPropertyHandler(Getter, 0, 0, 0, Enumerator);
+
+                    static const char *common_keys[] = {
+                        "access", "addr:city", "addr:housenumber", "addr:postcode", "addr:street",
+                        "admin_level", "amenity", "area", "boundary", "bridge", "building",
+                        "created_by", "highway", "landuse", "layer", "leisure", "maxspeed",
+                        "name", "natural", "oneway", "place", "power", "railway", "ref",
+                        "route", "shop", "source", "surface", "tourism", "tunnel", "type",
+                        "waterway",
+                        0
+                    };
+                    for (int i=0; common_keys[i]; i++) {
+                        key_symbol(common_keys[i]);
+                    }
+                }
+
+                ~Tags() {
+                    for (std::map<std::string, v8::Persistent<v8::String> >::iterator it = key_symbols.begin(); it != key_symbols.end(); it++) {
+                        it->second.Dispose();
+                    }
+                }
+
+                /// plain Javascript object with all tags of the object
+                v8::Local<v8::Object> create_tags_object(Osmium::OSM::Object *object) {
+                    v8::HandleScope handle_scope;
+
+                    v8::Local<v8::Object> tags = v8::Object::New();
+                    const int num_tags = object->tag_count();
+                    for (int i=0; i < num_tags; i++) {
+                        tags->Set(key_symbol(object->get_tag_key(i)), v8::String::New(object->get_tag_value(i)));
+                    }
+
+                    return handle_scope.Close(tags);
                 }
 
             }; // class Tags
@@ -16,17 +16,7 @@ namespace Osmium {
                     v8::String::Utf8Value key(property);
 
                     if (!strcmp(*key, "linestring_wkt")) {
-                        const osm_sequence_id_t num_nodes = self->object->node_count();
-                        std::ostringstream oss;
-                        oss << "LINESTRING(";
-                        for (osm_sequence_id_t i=0; i < num_nodes; i++) {
-                            if (i != 0) {
-                                oss << ",";
-                            }
-                            oss << self->object->lon[i] << " " << self->object->lat[i];
-                        }
-                        oss << ")";
-                        return v8::String::New(oss.str().c_str());
+                        return handle_scope.Close(self->get_linestring_wkt());
                     }
 
                     return v8::Undefined();
@@ -0,0 +1,212 @@
+#ifndef OSMIUM_MULTIPOLYGON_PROFILE_HPP
+#define OSMIUM_MULTIPOLYGON_PROFILE_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+namespace Osmium {
+
+    namespace OSM {
+
+        /**
+        * What happened while building the geometry of one multipolygon
+        * relation: How long it took overall and in each phase, how big
+        * it was and how many (expensive) GEOS operations were needed.
+        */
+        class MultipolygonBuildStats {
+
+          public:
+
+            enum phase_t {
+                assemble_ways,
+                make_one_ring,
+                mor_polygonizer,
+                contains,
+                extra_polygons,
+                polygon_build,
+                inner_ring_touch,
+                multipolygon_build,
+                num_phases
+            };
+
+            static const char *phase_name(int phase) {
+                static const char *names[num_phases] = {
+                    "assemble_ways",
+                    "make_one_ring",
+                    "   thereof polygonizer",
+                    "contains",
+                    "extra_polygons",
+                    "polygon_build",
+                    "   thereof inner_ring_touch",
+                    "multipolygon_build"
+                };
+                return names[phase];
+            }
+
+            osm_object_id_t id;
+            int members;
+            int rings;
+            uint64_t geos_ops;
+            bool ok;
+
+            /// wall clock time for the whole build in seconds
+            double seconds;
+
+            double phase_seconds[num_phases];
+
+            MultipolygonBuildStats(osm_object_id_t id, int members) : id(id), members(members), rings(0), geos_ops(0), ok(false), seconds(0) {
+                for (int i=0; i < num_phases; i++) {
+                    phase_seconds[i] = 0;
+                    running[i] = false;
+                }
+                build_start = std::chrono::steady_clock::now();
+            }
+
+            void start(phase_t phase) {
+                phase_start[phase] = std::chrono::steady_clock::now();
+                running[phase] = true;
+            }
+
+            /// stopping a phase that isn't running does nothing
+            void stop(phase_t phase) {
+                if (running[phase]) {
+                    phase_seconds[phase] += elapsed(phase_start[phase]);
+                    running[phase] = false;
+                }
+            }
+
+            /**
+            * Call when the build is done, ok is whether it succeeded.
+            * Phases still running (because the build bailed out early)
+            * are stopped.
+            */
+            void finish(bool success) {
+                for (int i=0; i < num_phases; i++) {
+                    stop(phase_t(i));
+                }
+                ok = success;
+                seconds = elapsed(build_start);
+            }
+
+          private:
+
+            std::chrono::steady_clock::time_point build_start;
+            std::chrono::steady_clock::time_point phase_start[num_phases];
+            bool running[num_phases];
+
+            static double elapsed(std::chrono::steady_clock::time_point since) {
+                return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+            }
+
+        }; // class MultipolygonBuildStats
+
+        /**
+        * Collects the MultipolygonBuildStats of all multipolygon relations.
+        * Keeps the slowest relations, a histogram of the build times and
+        * totals per phase. Multipolygons are built in worker threads, so
+        * add() can be called concurrently.
+        */
+        class MultipolygonProfile {
+
+            /// histogram bucket n counts builds that took less than 2^n microseconds
+            static const int num_buckets = 32;
+
+            std::mutex mutex;
+
+            unsigned int max_slowest;
+
+            /// min-heap (by seconds) of the slowest builds seen so far
+            std::vector<MultipolygonBuildStats> slowest;
+
+            uint64_t histogram[num_buckets];
+
+            uint64_t count;
+            uint64_t failed;
+            uint64_t geos_ops;
+            double seconds;
+            double phase_seconds[MultipolygonBuildStats::num_phases];
+
+            static bool faster(const MultipolygonBuildStats &a, const MultipolygonBuildStats &b) {
+                return a.seconds > b.seconds;
+            }
+
+            static int bucket(double seconds) {
+                uint64_t us = seconds * 1000000;
+                int n = 0;
+                while (us && n < num_buckets - 1) {
+                    us >>= 1;
+                    n++;
+                }
+                return n;
+            }
+
+          public:
+
+            MultipolygonProfile(unsigned int max_slowest=20) : max_slowest(max_slowest), count(0), failed(0), geos_ops(0), seconds(0) {
+                for (int i=0; i < num_buckets; i++) {
+                    histogram[i] = 0;
+                }
+                for (int i=0; i < MultipolygonBuildStats::num_phases; i++) {
+                    phase_seconds[i] = 0;
+                }
+            }
+
+            void add(const MultipolygonBuildStats &stats) {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                count++;
+                if (!stats.ok) failed++;
+                geos_ops += stats.geos_ops;
+                seconds += stats.seconds;
+                for (int i=0; i < MultipolygonBuildStats::num_phases; i++) {
+                    phase_seconds[i] += stats.phase_seconds[i];
+                }
+                histogram[bucket(stats.seconds)]++;
+
+                if (slowest.size() < max_slowest) {
+                    slowest.push_back(stats);
+                    std::push_heap(slowest.begin(), slowest.end(), faster);
+                } else if (max_slowest > 0 && stats.seconds > slowest.front().seconds) {
+                    std::pop_heap(slowest.begin(), slowest.end(), faster);
+                    slowest.back() = stats;
+                    std::push_heap(slowest.begin(), slowest.end(), faster);
+                }
+            }
+
+            void print(std::ostream &out) {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                out << std::setiosflags(std::ios::fixed) << std::setprecision(3);
+                out << "multipolygon profile: " << count << " relations built (" << failed << " failed) in " << seconds << "s, " << geos_ops << " GEOS operations" << std::endl;
+
+                out << "time per phase:" << std::endl;
+                for (int i=0; i < MultipolygonBuildStats::num_phases; i++) {
+                    out << "  " << std::setw(28) << std::left << MultipolygonBuildStats::phase_name(i) << std::right << std::setw(12) << phase_seconds[i] << "s" << std::endl;
+                }
+
+                out << "build time histogram:" << std::endl;
+                for (int i=0; i < num_buckets; i++) {
+                    if (histogram[i]) {
+                        out << "  < " << std::setw(12) << (uint64_t(1) << i) << "us: " << histogram[i] << std::endl;
+                    }
+                }
+
+                std::vector<MultipolygonBuildStats> s(slowest);
+                std::sort_heap(s.begin(), s.end(), faster);
+                out << "slowest " << s.size() << " relations:" << std::endl;
+                for (std::vector<MultipolygonBuildStats>::const_iterator it = s.begin(); it != s.end(); it++) {
+                    out << "  relation " << it->id << ": " << it->seconds << "s, " << it->members << " members, " << it->rings << " rings, " << it->geos_ops << " GEOS operations" << (it->ok ? "" : ", failed") << std::endl;
+                }
+            }
+
+        }; // class MultipolygonProfile
+
+    } // namespace OSM
+
+} // namespace Osmium
+
+#endif // OSMIUM_MULTIPOLYGON_PROFILE_HPP
@@ -1,21 +1,31 @@
 #ifndef OSMIUM_OSM_MULTIPOLYGON_HPP
 #define OSMIUM_OSM_MULTIPOLYGON_HPP
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
 #ifdef WITH_GEOS
+#include <google/sparse_hash_map>
+#include <geos/geom/Coordinate.h>
+#include <geos/geom/CoordinateSequenceFactory.h>
 #include <geos/geom/Geometry.h>
 #include <geos/geom/Point.h>
 #include <geos/geom/LineString.h>
+#include <geos/geom/LinearRing.h>
 #include <geos/geom/Polygon.h>
 #include <geos/io/WKTWriter.h>
+#include <geos/util/GEOSException.h>
 #endif
 
 #ifdef WITH_SHPLIB
 #include <shapefil.h>
 #endif
 
-#ifdef WITH_MULTIPOLYGON_PROFILING
-#include "timer.h"
-#endif
+#include "MultipolygonProfile.hpp"
 
 namespace Osmium {
 
@@ -24,10 +34,203 @@ namespace Osmium {
         enum innerouter_t { UNSET, INNER, OUTER };
         enum direction_t { NO_DIRECTION, CLOCKWISE, COUNTERCLOCKWISE };
 
+        /// does this object have no tags (ignoring tags like created_by or source)?
+        bool untagged(const Object *r);
+
+        /**
+        * Does the closed ring with the given coordinates (first and last
+        * point are the same, no consecutive duplicates) neither touch
+        * nor intersect itself?
+        */
+        bool ring_is_simple(const double *x, const double *y, int num_points);
+
+        /// signed area of a closed ring, positive if it is counterclockwise
+        double ring_area(const double *x, const double *y, int num_points);
+
+        /**
+        * What we need to remember about a member way of a multipolygon
+        * relation until all member ways are there: The id, the ids of the
+        * first and last node and the coordinates packed as fixed point
+        * integers. A full copy of the way (with all its tags) is only kept
+        * if the tags might be needed (see MultipolygonFromRelation::add_member_way()).
+        */
+        class MemberWay {
+
+            MemberWay(const MemberWay &);
+            MemberWay& operator=(const MemberWay &);
+
+            MemberWay() : id(0), first_node_id(0), last_node_id(0), timestamp(0), coordinates(), way(NULL) {
+            }
+
+            static void write_raw(FILE *file, const void *data, size_t size) {
+                if (size > 0 && fwrite(data, size, 1, file) != 1) {
+                    throw std::runtime_error("can not write member way to spill file");
+                }
+            }
+
+            static void read_raw(FILE *file, void *data, size_t size) {
+                if (size > 0 && fread(data, size, 1, file) != 1) {
+                    throw std::runtime_error("can not read member way from spill file");
+                }
+            }
+
+          public:
+
+            static const int coordinate_precision = 10000000;
+
+            osm_object_id_t id;
+            osm_object_id_t first_node_id;
+            osm_object_id_t last_node_id;
+            time_t timestamp;
+
+            /// lon and lat of all nodes (alternating), multiplied by coordinate_precision
+            std::vector<int32_t> coordinates;
+
+            /// copy of the way, NULL if its tags are not needed
+            Way *way;
+
+            MemberWay(Way *w, bool keep_way) : id(w->get_id()), first_node_id(0), last_node_id(0), timestamp(w->get_timestamp()), coordinates(), way(NULL) {
+                if (w->node_count() > 0) {
+                    first_node_id = w->get_first_node_id();
+                    last_node_id  = w->get_last_node_id();
+                }
+                coordinates.reserve(2 * w->node_count());
+                for (int i=0; i < w->node_count(); i++) {
+                    coordinates.push_back(lround(w->lon[i] * coordinate_precision));
+                    coordinates.push_back(lround(w->lat[i] * coordinate_precision));
+                }
+                if (keep_way) {
+                    way = new Way(*w);
+                }
+            }
+
+            ~MemberWay() {
+                delete way;
+            }
+
+            int node_count() const {
+                return coordinates.size() / 2;
+            }
+
+            double get_lon(int n) const {
+                return double(coordinates[2*n]) / coordinate_precision;
+            }
+
+            double get_lat(int n) const {
+                return double(coordinates[2*n+1]) / coordinate_precision;
+            }
+
+            /// approximate number of bytes of memory used by this member way
+            size_t memory_usage() const {
+                size_t size = sizeof(MemberWay) + coordinates.capacity() * sizeof(int32_t);
+                if (way) {
+                    size += sizeof(Way) + way->node_count() * (sizeof(osm_object_id_t) + 2 * sizeof(double)) + way->tags.capacity() * sizeof(Tag);
+                }
+                return size;
+            }
+
+            /**
+            * Write this member way to a file. Used for spilling pending
+            * multipolygons to disk. The file must be read again by the
+            * same process, because user names are not written, only
+            * their ids in Osmium::string_pool().
+            */
+            void write(FILE *file) const {
+                const uint32_t num_coordinates = coordinates.size();
+                const char has_way = way ? 1 : 0;
+                write_raw(file, &id, sizeof(id));
+                write_raw(file, &first_node_id, sizeof(first_node_id));
+                write_raw(file, &last_node_id, sizeof(last_node_id));
+                write_raw(file, &timestamp, sizeof(timestamp));
+                write_raw(file, &num_coordinates, sizeof(num_coordinates));
+                write_raw(file, coordinates.data(), num_coordinates * sizeof(int32_t));
+                write_raw(file, &has_way, sizeof(has_way));
+
+                if (way) {
+                    write_raw(file, &way->version, sizeof(way->version));
+                    write_raw(file, &way->uid, sizeof(way->uid));
+                    write_raw(file, &way->changeset, sizeof(way->changeset));
+                    write_raw(file, &way->user_sid, sizeof(way->user_sid));
+
+                    const int32_t num_nodes = way->node_count();
+                    write_raw(file, &num_nodes, sizeof(num_nodes));
+                    write_raw(file, way->nodes, num_nodes * sizeof(osm_object_id_t));
+                    write_raw(file, way->lon, num_nodes * sizeof(double));
+                    write_raw(file, way->lat, num_nodes * sizeof(double));
+
+                    const int32_t num_tags = way->tag_count();
+                    write_raw(file, &num_tags, sizeof(num_tags));
+                    for (int i=0; i < num_tags; i++) {
+                        write_raw(file, way->get_tag_key(i), strlen(way->get_tag_key(i)) + 1);
+                        write_raw(file, way->get_tag_value(i), strlen(way->get_tag_value(i)) + 1);
+                    }
+                }
+            }
+
+            /**
+            * Read a member way written with write(). Returns NULL at the
+            * end of the file.
+            */
+            static MemberWay *read(FILE *file) {
+                MemberWay *mw = new MemberWay();
+                if (fread(&mw->id, sizeof(mw->id), 1, file) != 1) {
+                    delete mw;
+                    return NULL;
+                }
+
+                uint32_t num_coordinates;
+                char has_way;
+                read_raw(file, &mw->first_node_id, sizeof(mw->first_node_id));
+                read_raw(file, &mw->last_node_id, sizeof(mw->last_node_id));
+                read_raw(file, &mw->timestamp, sizeof(mw->timestamp));
+                read_raw(file, &num_coordinates, sizeof(num_coordinates));
+                mw->coordinates.resize(num_coordinates);
+                read_raw(file, mw->coordinates.data(), num_coordinates * sizeof(int32_t));
+                read_raw(file, &has_way, sizeof(has_way));
+
+                if (has_way) {
+                    Way w;
+                    w.id = mw->id;
+                    w.set_timestamp(mw->timestamp);
+                    read_raw(file, &w.version, sizeof(w.version));
+                    read_raw(file, &w.uid, sizeof(w.uid));
+                    read_raw(file, &w.changeset, sizeof(w.changeset));
+                    read_raw(file, &w.user_sid, sizeof(w.user_sid));
+
+                    int32_t num_nodes;
+                    read_raw(file, &num_nodes, sizeof(num_nodes));
+                    for (int i=0; i < num_nodes; i++) {
+                        osm_object_id_t ref;
+                        read_raw(file, &ref, sizeof(ref));
+                        w.add_node(ref);
+                    }
+                    read_raw(file, w.lon, num_nodes * sizeof(double));
+                    read_raw(file, w.lat, num_nodes * sizeof(double));
+
+                    int32_t num_tags;
+                    read_raw(file, &num_tags, sizeof(num_tags));
+                    std::string key, value;
+                    for (int i=0; i < num_tags; i++) {
+                        key.clear();
+                        value.clear();
+                        for (int c; (c = getc(file)) > 0; ) key.push_back(c);
+                        for (int c; (c = getc(file)) > 0; ) value.push_back(c);
+                        w.add_tag(key.c_str(), value.c_str());
+                    }
+
+                    mw->way = new Way(w);
+                }
+
+                return mw;
+            }
+
+        }; // class MemberWay
+
 #ifdef WITH_GEOS
         class WayInfo {
 
             friend class MultipolygonFromRelation;
+            friend class WayEndIndex;
 
             Osmium::OSM::Way *way;
             int used;
@@ -37,10 +240,9 @@ namespace Osmium {
             std::string errorhint;
             innerouter_t innerouter;
             innerouter_t orig_innerouter;
-            geos::geom::Geometry *way_geom;
+            std::vector<geos::geom::Coordinate> coordinates;
             int firstnode;
             int lastnode;
-            bool tried;
 
             WayInfo() {
                 way = NULL;
@@ -50,55 +252,103 @@ namespace Osmium {
                 sequence = 0;
                 invert = false;
                 duplicate = false;
-                way_geom = NULL;
                 firstnode = -1;
                 lastnode = -1;
-                tried = false;
             }
 
-            WayInfo(Osmium::OSM::Way *w, innerouter_t io) {
-                way = w;
-                way_geom = w->create_geos_geometry();
+            /** way will be NULL if the member way was stored without tags */
+            WayInfo(const MemberWay *mw, innerouter_t io) {
+                way = mw->way;
+                coordinates.reserve(mw->node_count());
+                for (int i=0; i < mw->node_count(); i++) {
+                    coordinates.push_back(geos::geom::Coordinate(mw->get_lon(i), mw->get_lat(i), DoubleNotANumber));
+                }
                 orig_innerouter = io;
                 used = -1;
                 innerouter = UNSET;
                 sequence = 0;
                 invert = false;
                 duplicate = false;
-                tried = false;
-                firstnode = w->get_first_node_id();
-                lastnode = w->get_last_node_id();
+                firstnode = mw->first_node_id;
+                lastnode = mw->last_node_id;
             }
 
             /** Special version with a synthetic way, not backed by real way object. */
-            WayInfo(geos::geom::Geometry *g, int first, int last, innerouter_t io) {
+            WayInfo(const geos::geom::Coordinate &c1, const geos::geom::Coordinate &c2, int first, int last, innerouter_t io) {
                 way = NULL;
-                way_geom = g;
+                coordinates.push_back(c1);
+                coordinates.push_back(c2);
                 orig_innerouter = io;
                 used = -1;
                 innerouter = UNSET;
                 sequence = 0;
                 invert = false;
                 duplicate = false;
-                tried = false;
                 firstnode = first;
                 lastnode = last;
             }
 
-            ~WayInfo() {
-                delete way_geom;
+            /// a way needs at least two nodes to be part of a ring
+            bool has_geometry() const {
+                return coordinates.size() >= 2;
             }
 
             geos::geom::Point *get_firstnode_geom() {
-                return (way ? way->get_first_node_geometry() : NULL);
+                return Osmium::geos_factory()->createPoint(coordinates.front());
             }
 
             geos::geom::Point *get_lastnode_geom() {
-                return (way ? way->get_last_node_geometry() : NULL);
+                return Osmium::geos_factory()->createPoint(coordinates.back());
             }
 
         };
 
+        /**
+        * Index from node ids to the ends of the ways starting or ending
+        * at that node. Way end 2*n is the first node of way n, way end
+        * 2*n+1 its last node. All way ends at the same node are chained
+        * through next_end in the order of the ways.
+        */
+        class WayEndIndex {
+
+            google::sparse_hash_map<osm_object_id_t, int> first_end;
+            std::vector<int> next_end;
+
+          public:
+
+            WayEndIndex() : first_end(), next_end() {
+            }
+
+            void build(const std::vector<WayInfo *> &ways) {
+                first_end.clear();
+                next_end.assign(2 * ways.size(), -1);
+
+                // go backwards so that the chains are in the order of the ways
+                for (int end = 2 * ways.size() - 1; end >= 0; end--) {
+                    const osm_object_id_t node = (end & 1) ? ways[end / 2]->lastnode : ways[end / 2]->firstnode;
+                    google::sparse_hash_map<osm_object_id_t, int>::iterator it = first_end.find(node);
+                    if (it == first_end.end()) {
+                        first_end.insert(std::pair<osm_object_id_t, int>(node, end));
+                    } else {
+                        next_end[end] = it->second;
+                        it->second = end;
+                    }
+                }
+            }
+
+            /// first way end at the given node, -1 if there is none
+            int first(osm_object_id_t node) const {
+                google::sparse_hash_map<osm_object_id_t, int>::const_iterator it = first_end.find(node);
+                return it == first_end.end() ? -1 : it->second;
+            }
+
+            /// next way end at the same node, -1 if there is none
+            int next(int end) const {
+                return next_end[end];
+            }
+
+        }; // class WayEndIndex
+
         class RingInfo {
 
             friend class MultipolygonFromRelation;
@@ -149,13 +399,23 @@ namespace Osmium {
 #endif
             }
 
+          public:
+
+#ifdef WITH_GEOS
+            /// the GEOS geometry of this multipolygon, NULL if there is none
+            virtual geos::geom::Geometry *get_geometry() {
+                return geometry;
+            }
+#endif
+
         }; // class Multipolygon
 
         /***
         * Multipolygon created from a way (so strictly speaking this will
         * always be a simple polygon).
-        * The way pointer given to the constructor will not be stored, all
-        * needed attributes are copied.
+        * The way pointer given to the constructor or set_way() will not
+        * be stored, all needed attributes are copied. The GEOS geometry
+        * is only created when get_geometry() is called.
         */
         class MultipolygonFromWay : public Multipolygon {
 
@@ -165,12 +425,30 @@ namespace Osmium {
 
           public:
 
-            MultipolygonFromWay(Way *way, geos::geom::Geometry *geom) : Multipolygon(geom) {
+            MultipolygonFromWay() : Multipolygon(), num_nodes(0) {
+            }
+
+            MultipolygonFromWay(Way *way, geos::geom::Geometry *geom) : Multipolygon() {
+                set_way(way);
+                geometry = geom;
+            }
+
+            /**
+            * Re-initialize this multipolygon from the given closed way.
+            * This allows one object to be reused for all closed ways.
+            */
+            void set_way(Way *way) {
+                if (geometry) {
+                    delete geometry;
+                    geometry = NULL;
+                }
+
                 id        = way->get_id();
                 version   = way->get_version();
                 uid       = way->get_uid();
                 changeset = way->get_changeset();
-                timestamp = way->get_timestamp();
+                set_timestamp(way->get_timestamp());
+                user_sid  = way->user_sid;
 
                 num_tags  = way->tag_count();
                 tags      = way->tags;
@@ -182,6 +460,59 @@ namespace Osmium {
                 }
             }
 
+            /**
+            * Check that the way forms a valid polygon and bring it into
+            * canonical form: Consecutive duplicate points are removed
+            * and the ring is oriented clockwise, like the outer rings of
+            * multipolygons built from relations.
+            *
+            * Returns false if the way isn't a valid polygon, it must not
+            * be used as an area then.
+            */
+            bool normalize() {
+                int n = 0;
+                for (int i=0; i < num_nodes; i++) {
+                    if (n == 0 || lon[i] != lon[n-1] || lat[i] != lat[n-1]) {
+                        lon[n] = lon[i];
+                        lat[n] = lat[i];
+                        n++;
+                    }
+                }
+                num_nodes = n;
+
+                if (num_nodes < 4 || lon[0] != lon[num_nodes-1] || lat[0] != lat[num_nodes-1]) {
+                    return false;
+                }
+
+                if (!ring_is_simple(lon, lat, num_nodes)) {
+                    return false;
+                }
+
+                if (ring_area(lon, lat, num_nodes) > 0) {
+                    std::reverse(lon, lon + num_nodes);
+                    std::reverse(lat, lat + num_nodes);
+                }
+
+                return true;
+            }
+
+            geos::geom::Geometry *get_geometry() {
+                if (!geometry && num_nodes >= 4) {
+                    std::vector<geos::geom::Coordinate> *c = new std::vector<geos::geom::Coordinate>(num_nodes);
+                    for (int i=0; i < num_nodes; i++) {
+                        (*c)[i] = geos::geom::Coordinate(lon[i], lat[i]);
+                    }
+                    try {
+                        geos::geom::LinearRing *ring = Osmium::geos_factory()->createLinearRing(Osmium::geos_factory()->getCoordinateSequenceFactory()->create(c));
+                        geometry = Osmium::geos_factory()->createPolygon(ring, NULL);
+                    } catch (const geos::util::GEOSException& exc) {
+                        std::cerr << "error building polygon geometry, leave it as NULL" << std::endl;
+                        geometry = NULL;
+                    }
+                }
+                return geometry;
+            }
+
             osm_object_type_t get_type() const {
                 return MULTIPOLYGON_FROM_WAY;
             }
@@ -212,7 +543,7 @@ namespace Osmium {
             Relation *relation;
 
             /// the member ways of this multipolygon
-            std::vector<Osmium::OSM::Way> member_ways;
+            std::vector<MemberWay *> member_ways;
 
             /// number of ways in this multipolygon
             int num_ways;
@@ -228,79 +559,146 @@ namespace Osmium {
             /// whether we want to repair a broken geometry
             bool attempt_repair;
 
-#ifdef WITH_MULTIPOLYGON_PROFILING
-            static std::vector<std::pair<std::string, timer *> > timers;
-
-            timer write_complex_poly_timer;
-            timer assemble_ways_timer;
-            timer assemble_nodes_timer;
-            timer make_one_ring_timer;
-            timer mor_polygonizer_timer;
-            timer mor_union_timer;
-            timer contains_timer;
-            timer extra_polygons_timer;
-            timer polygon_build_timer;
-            timer inner_ring_touch_timer;
-            timer polygon_intersection_timer;
-            timer multipolygon_build_timer;
-            timer multipolygon_write_timer;
-            timer error_write_timer;
-#endif
+            /// has build_geometry() been called already?
+            bool built;
+
+            /**
+            * Multipolygons for tagged inner rings found while building the
+            * geometry. They are handed to the callback together with this
+            * multipolygon, because build_geometry() might run in a worker
+            * thread.
+            */
+            std::vector<MultipolygonFromWay *> extra_polygons;
+
+            /// collects build statistics of all multipolygons, NULL if profiling is disabled
+            MultipolygonProfile *profile;
+
+            /// statistics of the current build, only while build() runs with profiling enabled
+            MultipolygonBuildStats *stats;
 
           public:
 
-            MultipolygonFromRelation(Relation *r, bool b, int n, void (*callback)(Osmium::OSM::Multipolygon *), bool repair) : Multipolygon(), boundary(b), relation(r), callback(callback) {
+            MultipolygonFromRelation(Relation *r, bool b, int n, void (*callback)(Osmium::OSM::Multipolygon *), bool repair, MultipolygonProfile *profile=NULL) : Multipolygon(), boundary(b), relation(r), callback(callback), profile(profile), stats(NULL) {
                 num_ways = n;
                 missing_ways = n;
                 geometry = NULL;
                 id = r->get_id();
                 attempt_repair = repair;
-
-#ifdef WITH_MULTIPOLYGON_PROFILING
-                timers.push_back(std::pair<std::string, timer *> ("   thereof assemble_ways", &assemble_ways_timer));
-                timers.push_back(std::pair<std::string, timer *> ("   thereof make_one_ring", &make_one_ring_timer));
-                timers.push_back(std::pair<std::string, timer *> ("      thereof union", &mor_union_timer));
-                timers.push_back(std::pair<std::string, timer *> ("      thereof polygonizer", &mor_polygonizer_timer));
-                timers.push_back(std::pair<std::string, timer *> ("   thereof contains", &contains_timer));
-                timers.push_back(std::pair<std::string, timer *> ("   thereof extra_polygons", &extra_polygons_timer));
-                timers.push_back(std::pair<std::string, timer *> ("   thereof polygon_build", &polygon_build_timer));
-                timers.push_back(std::pair<std::string, timer *> ("      thereof inner_ring_touch", &inner_ring_touch_timer));
-                timers.push_back(std::pair<std::string, timer *> ("      thereof intersections", &polygon_intersection_timer));
-                timers.push_back(std::pair<std::string, timer *> ("   thereof multipolygon_build", &multipolygon_build_timer));
-                timers.push_back(std::pair<std::string, timer *> ("   thereof multipolygon_write", &multipolygon_write_timer));
-                timers.push_back(std::pair<std::string, timer *> ("   thereof error_write", &error_write_timer));
-#endif
+                built = false;
             }
 
             ~MultipolygonFromRelation() {
+                for (std::vector<MultipolygonFromWay *>::iterator it = extra_polygons.begin(); it != extra_polygons.end(); it++) {
+                    delete *it;
+                }
                 delete relation;
-                member_ways.erase(member_ways.begin(), member_ways.end());
+                for (std::vector<MemberWay *>::iterator it = member_ways.begin(); it != member_ways.end(); it++) {
+                    delete *it;
+                }
             }
 
             osm_object_type_t get_type() const {
                 return MULTIPOLYGON_FROM_RELATION;
             }
 
-            /// Add way to list of member ways. This will create a copy of the way.
+            /**
+            * Add way to list of member ways. Only the geometry of the way is
+            * stored. The tags are needed only if the way is closed (then it
+            * might be a tagged inner ring that becomes a polygon of its own)
+            * or if the relation has no tags (old-style multipolygon with the
+            * tags on the outer way). Only in these cases a full copy of the
+            * way is stored.
+            */
             void add_member_way(Osmium::OSM::Way *way) {
-                member_ways.push_back(*way);
+                add_member_way(create_member_way(way));
+            }
+
+            /// Create MemberWay from way with the tags if needed (see add_member_way(Way *)).
+            MemberWay *create_member_way(Osmium::OSM::Way *way) const {
+                const bool keep_way = !untagged(way) && (way->is_closed() || untagged(relation));
+                return new MemberWay(way, keep_way);
+            }
+
+            /// Add member way. Takes ownership of the MemberWay.
+            void add_member_way(MemberWay *member_way) {
+                member_ways.push_back(member_way);
                 missing_ways--;
             }
 
+            /**
+            * Remove all member ways added so far and give them to the
+            * caller, who takes ownership. They can be added again later.
+            */
+            std::vector<MemberWay *> release_member_ways() {
+                std::vector<MemberWay *> released;
+                released.swap(member_ways);
+                missing_ways += released.size();
+                return released;
+            }
+
+            /// approximate number of bytes used by the member ways added so far
+            size_t member_ways_memory_usage() const {
+                size_t size = 0;
+                for (std::vector<MemberWay *>::const_iterator it = member_ways.begin(); it != member_ways.end(); it++) {
+                    size += (*it)->memory_usage();
+                }
+                return size;
+            }
+
             /// Do we have all the ways we need to build this multipolygon?
             bool is_complete() {
                 return missing_ways == 0;
             }
 
-            void handle_complete_multipolygon() {
-                std::cerr << "MP multi multi=" << id << " done\n";
+            /**
+            * Build the geometry of a complete multipolygon. This doesn't
+            * call any callbacks, so it can be run in a worker thread.
+            */
+            void build() {
+                if (profile) {
+                    stats = new MultipolygonBuildStats(id, num_ways);
+                }
+                bool ok = false;
+                try {
+                    ok = build_geometry();
+                } catch (const std::exception &e) {
+                    geometry_error(e.what());
+                }
+                built = true;
+                if (stats) {
+                    stats->finish(ok);
+                    profile->add(*stats);
+                    delete stats;
+                    stats = NULL;
+                }
+            }
+
+            /**
+            * Hand the complete multipolygon and the multipolygons created
+            * from tagged inner rings to the callback. Builds the geometry
+            * first if this hasn't happened yet.
+            */
+            void handle_complete_multipolygon(bool debug=false) {
+                if (!built) {
+                    build();
+                }
+
+                if (debug) {
+                    std::cerr << "MP multi multi=" << id << " done\n";
+
+                    if (geometry) {
+                        geos::io::WKTWriter wkt;
+                        std::cerr << "  mp geometry: " << wkt.write(geometry) << std::endl;
+                    } else {
+                        std::cerr << "  geom build error: " << geometry_error_message << "\n";
+                    }
+                }
 
-                if (build_geometry()) {
-                    geos::io::WKTWriter wkt;
-                    std::cerr << "  mp geometry: " << wkt.write(geometry) << std::endl;
-                } else {
-                    std::cerr << "  geom build error: " << geometry_error_message << "\n";
+                for (std::vector<MultipolygonFromWay *>::iterator it = extra_polygons.begin(); it != extra_polygons.end(); it++) {
+                    callback(*it);
+                    delete *it;
                 }
+                extra_polygons.clear();
 
                 callback(this);
             }
@@ -353,20 +751,13 @@ namespace Osmium {
             }
 #endif
 
-#ifdef WITH_MULTIPOLYGON_PROFILING
-            static void print_timings() {
-                for (unsigned int i=0; i<timers.size(); i++) {
-                    std::cerr << timers[i].first << ": " << *(timers[i].second) << std::endl;
-                }
-            }
-#endif
-
           private:
 
 #ifdef WITH_GEOS
             bool build_geometry();
 
-            RingInfo *make_one_ring(std::vector<WayInfo *> &ways, osm_object_id_t first, osm_object_id_t last, int ringcount, int sequence);
+            RingInfo *make_one_ring(std::vector<WayInfo *> &ways, const WayEndIndex &way_ends, int ringcount);
+            RingInfo *make_ring_from_ways(std::vector<WayInfo *> &ways, const std::vector<int> &sequence);
             bool find_and_repair_holes_in_rings(std::vector<WayInfo *> *ways);
             bool geometry_error(const char *message);
             geos::geom::LinearRing *create_non_intersecting_linear_ring(geos::geom::CoordinateSequence *cs);
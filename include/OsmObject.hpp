@@ -9,6 +9,8 @@
 #include <vector>
 #include <time.h>
 
+#include "Timestamp.hpp"
+
 #ifdef WITH_SHPLIB
 #include <shapefil.h>
 #endif
@@ -26,7 +28,7 @@ namespace Osmium {
 
           public:
 
-            static const int max_length_timestamp = 20 + 1; ///< maximum length of OSM object timestamp string (20 characters + null byte)
+            static const int max_length_timestamp = Osmium::Timestamp::max_length; ///< maximum length of OSM object timestamp string (20 characters + null byte)
             static const int max_length_username = 255 * 4 + 1; ///< maximum length of OSM user name (255 UTF-8 characters + null byte)
 
             osm_object_id_t    id;        ///< object id
@@ -34,13 +36,14 @@ namespace Osmium {
             osm_user_id_t      uid;       ///< user id of user who last changed this object
             osm_changeset_id_t changeset; ///< id of last changeset that changed this object
 
-            // timestamp is stored as string, no need to parse it in most cases
-            char timestamp_str[max_length_timestamp];
-            time_t timestamp;
-            char user[max_length_username]; ///< name of user who last changed this object
+            time_t             timestamp; ///< when this object was last changed (seconds since the epoch)
+            StringStore::string_id_t user_sid; ///< name of user who last changed this object (id in Osmium::string_pool())
 
           protected:
 
+            // timestamp as string, only filled in when get_timestamp_str() is called
+            char timestamp_str[max_length_timestamp];
+
             // how many tags are there on this object (XXX we could probably live without this and just use tags.size())
             int num_tags;
 
@@ -50,11 +53,15 @@ namespace Osmium {
 
             void *wrapper;
 
-            Object() : tags() {
+            /// changed by every reset(), so that data cached for the object (for instance by a wrapper) can be invalidated
+            unsigned int generation;
+
+            Object() : tags(), generation(0) {
                 reset();
             }
 
             Object(const Object &o) {
+                generation = 0;
                 id        = o.id;
                 version   = o.version;
                 uid       = o.uid;
@@ -62,8 +69,8 @@ namespace Osmium {
                 timestamp = o.timestamp;
                 num_tags  = o.num_tags;
                 tags      = o.tags;
+                user_sid  = o.user_sid;
                 strncpy(timestamp_str, o.timestamp_str, max_length_timestamp);
-                strncpy(user, o.user, max_length_username);
             }
 
             ~Object() {
@@ -72,13 +79,14 @@ namespace Osmium {
             virtual osm_object_type_t get_type() const = 0;
 
             virtual void reset() {
+                generation++;
                 id               = 0;
                 version          = 0;
                 uid              = 0;
                 changeset        = 0;
                 timestamp_str[0] = '\0';
                 timestamp        = 0;
-                user[0]          = '\0';
+                user_sid         = 0;
                 num_tags         = 0;
                 tags.clear();
             }
@@ -89,15 +97,11 @@ namespace Osmium {
                 } else if (!strcmp(attr, "version")) {
                     version = STR_TO_VERSION(value);
                 } else if (!strcmp(attr, "timestamp")) {
-                    if (! memccpy(timestamp_str, value, 0, max_length_timestamp)) {
-                        throw std::length_error("timestamp too long");
-                    }
+                    set_timestamp(Osmium::Timestamp::parse(value));
                 } else if (!strcmp(attr, "uid")) {
                     uid = STR_TO_USER_ID(value);
                 } else if (!strcmp(attr, "user")) {
-                    if (! memccpy(user, value, 0, max_length_username)) {
-                        throw std::length_error("user name too long");
-                    }
+                    set_user(value);
                 } else if (!strcmp(attr, "changeset")) {
                     changeset = STR_TO_CHANGESET_ID(value);
                 }
@@ -120,29 +124,35 @@ namespace Osmium {
                 return changeset;
             }
 
-            time_t get_timestamp() {
-                if (timestamp == 0) {
-                    if (timestamp_str[0] == '\0') {
-                        return 0;
-                    }
-                    struct tm tm;
-                    if (strptime(timestamp_str, "%Y-%m-%dT%H:%M:%SZ", &tm) == NULL) {
-                        timestamp = -1;
-                    } else {
-                        timestamp = mktime(&tm);
-                    }
+            // get name of user who last changed this object, empty string if unknown
+            const char *get_user() const {
+                return Osmium::string_pool()->get(user_sid);
+            }
+
+            void set_user(const char *user) {
+                if (strlen(user) >= (size_t) max_length_username) {
+                    throw std::length_error("user name too long");
                 }
+                user_sid = Osmium::string_pool()->intern(user);
+            }
+
+            time_t get_timestamp() const {
                 return timestamp;
             }
 
+            void set_timestamp(time_t t) {
+                timestamp        = t;
+                timestamp_str[0] = '\0';
+            }
+
+            /**
+            * Get timestamp as string in ISO 8601 format. Returns an empty
+            * string if the object has no timestamp. The string is created
+            * on first use and stays valid until the timestamp is changed.
+            */
             const char *get_timestamp_str() {
-                if (timestamp_str[0] == '\0') {
-                    if (timestamp == 0) {
-                        return "";
-                    }
-                    struct tm *tm;
-                    tm = gmtime(&timestamp);
-                    strftime(timestamp_str, sizeof(timestamp_str), "%Y-%m-%dT%H:%M:%SZ", tm);
+                if (timestamp_str[0] == '\0' && timestamp != 0) {
+                    Osmium::Timestamp::to_iso(timestamp, timestamp_str);
                 }
                 return timestamp_str;
             }
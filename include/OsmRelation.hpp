@@ -12,16 +12,25 @@ namespace Osmium {
 
     namespace OSM {
 
+        /**
+        * A member of a relation. The role is interned in the global
+        * Osmium::string_pool(), so that a member only needs a few bytes
+        * (the fields are ordered so that this is 16 bytes even with
+        * 64 bit object ids).
+        */
         class RelationMember {
 
           public:
 
             static const int max_length_role = 255 * 4 + 1; /* 255 UTF-8 characters + null byte */
 
-            osm_object_id_t ref;
-            char            type;
-            char            role[max_length_role];
-            Object         *object;
+            osm_object_id_t          ref;
+            StringStore::string_id_t role_sid; ///< id of role in Osmium::string_pool()
+            char                     type;
+
+            const char *get_role() const {
+                return Osmium::string_pool()->get(role_sid);
+            }
 
         };
 
@@ -53,17 +62,20 @@ namespace Osmium {
             }
 
             void add_member(const char type, osm_object_id_t ref, const char *role) {
-                /* first we resize the vector... */
-                members.resize(num_members+1);
-                /* ...and get an address for the new element... */
-                RelationMember *m = &members[num_members++];
-                /* ...so that we can directly write into the memory and avoid
-                a second copy */
-                m->type = type;
-                m->ref = ref;
-                if (! memccpy(m->role, role, 0, RelationMember::max_length_role)) {
+                if (strlen(role) >= (size_t) RelationMember::max_length_role) {
                     throw std::length_error("role too long");
                 }
+                add_member(type, ref, Osmium::string_pool()->intern(role));
+            }
+
+            /// add member with a role that has already been interned in Osmium::string_pool()
+            void add_member(const char type, osm_object_id_t ref, StringStore::string_id_t role_sid) {
+                RelationMember m;
+                m.ref      = ref;
+                m.role_sid = role_sid;
+                m.type     = type;
+                members.push_back(m);
+                num_members++;
             }
 
             osm_sequence_id_t member_count() const {
@@ -0,0 +1,508 @@
+#ifndef OSMIUM_OUTPUT_PBF_HPP
+#define OSMIUM_OUTPUT_PBF_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <fileformat.pb.h>
+#include <osmformat.pb.h>
+
+namespace Osmium {
+
+    namespace Output {
+
+        /**
+        * Handler writing all objects it gets to an OSM file in PBF format
+        * (see http://wiki.openstreetmap.org/wiki/PBF_Format). The objects
+        * must come in the usual order (nodes, ways, relations).
+        *
+        * Nodes are written as DenseNodes. Each block has its own string
+        * table, the strings are sorted by how often they are used so that
+        * the most common strings get the shortest indexes.
+        *
+        * The blocks are serialized and compressed in worker threads, but
+        * always written in the order the objects came in, so the output
+        * doesn't depend on the number of threads.
+        */
+        class PBF : public Handler::Base {
+
+            static const int NANO = 1000 * 1000 * 1000;
+
+            /// resolution of coordinates in nanodegrees (default of the PBF format)
+            static const int granularity = 100;
+
+            /// resolution of timestamps in milliseconds (default of the PBF format)
+            static const int date_granularity = 1000;
+
+            /// maximum number of objects in a block (as recommended by the format description)
+            static const int max_block_objects = 8000;
+
+            /// a block is also written when it gets bigger than about this many bytes (uncompressed)
+            static const size_t max_block_size = 8 * 1024 * 1024;
+
+            /**
+            * A block of objects to be encoded and compressed by a worker.
+            * The data is the finished BlobHeader and Blob as it goes into
+            * the file.
+            */
+            struct Job {
+                OSMPBF::PrimitiveBlock *block;
+                std::string data;
+                bool done;
+
+                Job(OSMPBF::PrimitiveBlock *block) : block(block), data(), done(false) {
+                }
+            };
+
+            int fd;
+            int compression_level;
+
+            /// the block being filled, NULL if there are no objects yet
+            OSMPBF::PrimitiveBlock *block;
+            OSMPBF::PrimitiveGroup *group;
+            osm_object_type_t block_type;
+            int block_objects;
+            size_t block_size;
+
+            /// the string table of the current block while it is filled: string -> (index, count)
+            typedef std::map<std::string, std::pair<int, int> > string_map;
+            string_map strings;
+
+            // last values of the delta encoded fields of DenseNodes
+            int64_t last_id;
+            int64_t last_lat;
+            int64_t last_lon;
+            int64_t last_timestamp;
+            int64_t last_changeset;
+            int64_t last_uid;
+            int64_t last_user_sid;
+
+            std::vector<std::thread> workers;
+
+            std::mutex mutex;
+            std::condition_variable job_added;
+            std::condition_variable job_done;
+
+            // protected by mutex
+            std::deque<Job *> jobs;    ///< all jobs not written yet, in order
+            std::deque<Job *> pending; ///< jobs no worker has taken yet
+            bool shutdown;
+            std::string error;
+
+            PBF(const PBF &);
+            PBF &operator=(const PBF &);
+
+            /// add string to the string table of the current block, returns its (preliminary) index
+            int string_index(const char *s) {
+                string_map::iterator it = strings.find(s);
+                if (it == strings.end()) {
+                    it = strings.insert(std::make_pair(std::string(s), std::make_pair(int(strings.size()) + 1, 0))).first;
+                    block_size += it->first.size() + 2;
+                }
+                it->second.second++;
+                return it->second.first;
+            }
+
+            /// coordinate in units of granularity, nodes without a location are written at 0, 0
+            static int64_t coordinate(double c) {
+                return std::isfinite(c) ? std::llround(c * (NANO / granularity)) : 0;
+            }
+
+            static bool more_common(const string_map::value_type *a, const string_map::value_type *b) {
+                return a->second.second > b->second.second;
+            }
+
+            static void set_info(OSMPBF::Info *info, const OSM::Object *object, int user_sid) {
+                info->set_version(object->get_version());
+                info->set_timestamp(object->get_timestamp() * 1000 / date_granularity);
+                info->set_changeset(object->get_changeset());
+                info->set_uid(object->get_uid());
+                info->set_user_sid(user_sid);
+            }
+
+            void start_block(osm_object_type_t type) {
+                block = new OSMPBF::PrimitiveBlock();
+                block->set_granularity(granularity);
+                block->set_date_granularity(date_granularity);
+                group = block->add_primitivegroup();
+                block_type = type;
+                block_objects = 0;
+                block_size = 0;
+                strings.clear();
+
+                if (type == NODE) {
+                    last_id = last_lat = last_lon = last_timestamp = last_changeset = last_uid = last_user_sid = 0;
+                }
+            }
+
+            /// string indexes sorted by count, so common strings get short varints
+            void finish_string_table() {
+                // strings used equally often stay in alphabetical order, so the output is always the same
+                std::vector<const string_map::value_type *> by_count;
+                for (string_map::const_iterator it = strings.begin(); it != strings.end(); it++) {
+                    by_count.push_back(&*it);
+                }
+                std::stable_sort(by_count.begin(), by_count.end(), more_common);
+
+                std::vector<int> new_index(strings.size() + 1, 0);
+                OSMPBF::StringTable *stringtable = block->mutable_stringtable();
+                stringtable->add_s(""); // index 0 is never used (it ends the tags in DenseNodes)
+                for (unsigned int i=0; i < by_count.size(); i++) {
+                    new_index[by_count[i]->second.first] = i + 1;
+                    stringtable->add_s(by_count[i]->first);
+                }
+
+                // rewrite all string indexes in the block
+                if (group->has_dense()) {
+                    OSMPBF::DenseNodes *dense = group->mutable_dense();
+                    for (int i=0; i < dense->keys_vals_size(); i++) {
+                        dense->set_keys_vals(i, new_index[dense->keys_vals(i)]);
+                    }
+                    // the user_sids are delta encoded
+                    OSMPBF::DenseInfo *denseinfo = dense->mutable_denseinfo();
+                    int64_t last = 0, new_last = 0;
+                    for (int i=0; i < denseinfo->user_sid_size(); i++) {
+                        last += denseinfo->user_sid(i);
+                        denseinfo->set_user_sid(i, new_index[last] - new_last);
+                        new_last = new_index[last];
+                    }
+                }
+                for (int i=0; i < group->ways_size(); i++) {
+                    remap_strings(group->mutable_ways(i), new_index);
+                }
+                for (int i=0; i < group->relations_size(); i++) {
+                    OSMPBF::Relation *relation = group->mutable_relations(i);
+                    remap_strings(relation, new_index);
+                    for (int j=0; j < relation->roles_sid_size(); j++) {
+                        relation->set_roles_sid(j, new_index[relation->roles_sid(j)]);
+                    }
+                }
+            }
+
+            template <class T>
+            static void remap_strings(T *object, const std::vector<int> &new_index) {
+                for (int i=0; i < object->keys_size(); i++) {
+                    object->set_keys(i, new_index[object->keys(i)]);
+                    object->set_vals(i, new_index[object->vals(i)]);
+                }
+                object->mutable_info()->set_user_sid(new_index[object->info().user_sid()]);
+            }
+
+            /// hand the current block to the workers (or encode it right here without workers)
+            void flush_block() {
+                if (!block) {
+                    return;
+                }
+                finish_string_table();
+                Job *job = new Job(block);
+                block = NULL;
+
+                if (workers.empty()) {
+                    encode(job);
+                    write_data(job->data);
+                    delete job;
+                    return;
+                }
+
+                std::unique_lock<std::mutex> lock(mutex);
+                jobs.push_back(job);
+                pending.push_back(job);
+                job_added.notify_one();
+
+                // write finished blocks and don't let too many blocks pile up
+                while (!jobs.empty() && (jobs.front()->done || jobs.size() > 2 * workers.size())) {
+                    write_finished_jobs(lock);
+                }
+            }
+
+            /// write the finished jobs at the front of the queue, wait for the first one if necessary, mutex must be locked
+            void write_finished_jobs(std::unique_lock<std::mutex> &lock) {
+                while (!jobs.front()->done && error.empty()) {
+                    job_done.wait(lock);
+                }
+                if (!error.empty()) {
+                    throw std::runtime_error(error);
+                }
+                while (!jobs.empty() && jobs.front()->done) {
+                    Job *job = jobs.front();
+                    jobs.pop_front();
+                    lock.unlock();
+                    write_data(job->data);
+                    delete job;
+                    lock.lock();
+                }
+            }
+
+            /// wrap data in a Blob (compressed if compression_level isn't 0) and a BlobHeader
+            static std::string make_blob(const char *type, const std::string &raw, int compression_level) {
+                OSMPBF::Blob blob;
+                if (compression_level == 0) {
+                    blob.set_raw(raw);
+                } else {
+                    uLongf size = compressBound(raw.size());
+                    std::string compressed(size, '\0');
+                    if (compress2((Bytef *) &compressed[0], &size, (const Bytef *) raw.data(), raw.size(), compression_level) != Z_OK) {
+                        throw std::runtime_error("failed to compress blob");
+                    }
+                    compressed.resize(size);
+                    blob.set_raw_size(raw.size());
+                    blob.set_zlib_data(compressed);
+                }
+                std::string blob_data;
+                blob.SerializeToString(&blob_data);
+
+                OSMPBF::BlockHeader header;
+                header.set_type(type);
+                header.set_datasize(blob_data.size());
+                std::string header_data;
+                header.SerializeToString(&header_data);
+
+                const uint32_t size = header_data.size();
+                std::string data;
+                data.reserve(4 + header_data.size() + blob_data.size());
+                data += char(size >> 24);
+                data += char(size >> 16);
+                data += char(size >>  8);
+                data += char(size);
+                data += header_data;
+                data += blob_data;
+                return data;
+            }
+
+            void encode(Job *job) const {
+                std::string raw;
+                job->block->SerializeToString(&raw);
+                delete job->block;
+                job->block = NULL;
+                job->data = make_blob("OSMData", raw, compression_level);
+            }
+
+            void worker() {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (true) {
+                    while (pending.empty() && !shutdown) {
+                        job_added.wait(lock);
+                    }
+                    if (pending.empty()) {
+                        return;
+                    }
+                    Job *job = pending.front();
+                    pending.pop_front();
+                    lock.unlock();
+
+                    std::string what;
+                    try {
+                        encode(job);
+                    } catch (std::exception &e) {
+                        what = e.what();
+                    }
+
+                    lock.lock();
+                    if (!what.empty()) {
+                        error = what;
+                    }
+                    job->done = true;
+                    job_done.notify_all();
+                }
+            }
+
+            void write_data(const std::string &data) {
+                size_t offset = 0;
+                while (offset < data.size()) {
+                    ssize_t length = ::write(fd, data.data() + offset, data.size() - offset);
+                    if (length < 0) {
+                        throw std::runtime_error(std::string("write error: ") + strerror(errno));
+                    }
+                    offset += length;
+                }
+            }
+
+            void write_header() {
+                OSMPBF::HeaderBlock header;
+                header.add_required_features("OsmSchema-V0.6");
+                header.add_required_features("DenseNodes");
+                header.set_writingprogram("Osmium");
+                std::string raw;
+                header.SerializeToString(&raw);
+                write_data(make_blob("OSMHeader", raw, compression_level));
+            }
+
+            /// get the block for an object of the given type, starts a new block if needed
+            void prepare_block(osm_object_type_t type) {
+                if (block && (block_type != type || block_objects >= max_block_objects || block_size >= max_block_size)) {
+                    flush_block();
+                }
+                if (!block) {
+                    start_block(type);
+                }
+                block_objects++;
+            }
+
+          public:
+
+            /**
+            * Open the file for writing (it is overwritten if it exists),
+            * "-" for STDOUT. The blocks are compressed with the given zlib
+            * compression level (0 for uncompressed blocks) in num_workers
+            * threads. With num_workers=0 everything is done in the calling
+            * thread.
+            */
+            PBF(bool debug, const char *filename, int num_workers=0, int compression_level=Z_DEFAULT_COMPRESSION) :
+                Base(debug),
+                compression_level(compression_level),
+                block(NULL),
+                group(NULL),
+                strings(),
+                shutdown(false) {
+                GOOGLE_PROTOBUF_VERIFY_VERSION;
+                if (filename[0] == '-' && filename[1] == '\0') {
+                    fd = 1;
+                } else {
+                    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+                    if (fd < 0) {
+                        throw std::runtime_error(std::string("can't open output file '") + filename + "': " + strerror(errno));
+                    }
+                }
+                for (int i=0; i < num_workers; i++) {
+                    workers.push_back(std::thread(&PBF::worker, this));
+                }
+            }
+
+            ~PBF() {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    shutdown = true;
+                }
+                job_added.notify_all();
+                for (std::vector<std::thread>::iterator it = workers.begin(); it != workers.end(); it++) {
+                    it->join();
+                }
+                for (std::deque<Job *>::iterator it = jobs.begin(); it != jobs.end(); it++) {
+                    delete (*it)->block;
+                    delete *it;
+                }
+                delete block;
+                if (fd > 2) {
+                    ::close(fd);
+                }
+            }
+
+            void callback_init() {
+                write_header();
+            }
+
+            void callback_node(OSM::Node *node) {
+                prepare_block(NODE);
+                OSMPBF::DenseNodes *dense = group->mutable_dense();
+                OSMPBF::DenseInfo *denseinfo = dense->mutable_denseinfo();
+
+                const int64_t lat = coordinate(node->get_lat());
+                const int64_t lon = coordinate(node->get_lon());
+                const int64_t user_sid = string_index(node->get_user());
+
+                dense->add_id(node->get_id() - last_id);
+                dense->add_lat(lat - last_lat);
+                dense->add_lon(lon - last_lon);
+                denseinfo->add_version(node->get_version());
+                denseinfo->add_timestamp(node->get_timestamp() * 1000 / date_granularity - last_timestamp);
+                denseinfo->add_changeset(node->get_changeset() - last_changeset);
+                denseinfo->add_uid(node->get_uid() - last_uid);
+                denseinfo->add_user_sid(user_sid - last_user_sid);
+
+                last_id        = node->get_id();
+                last_lat       = lat;
+                last_lon       = lon;
+                last_timestamp = node->get_timestamp() * 1000 / date_granularity;
+                last_changeset = node->get_changeset();
+                last_uid       = node->get_uid();
+                last_user_sid  = user_sid;
+
+                for (int i=0; i < node->tag_count(); i++) {
+                    dense->add_keys_vals(string_index(node->get_tag_key(i)));
+                    dense->add_keys_vals(string_index(node->get_tag_value(i)));
+                }
+                dense->add_keys_vals(0);
+
+                block_size += 30 + 4 * node->tag_count();
+            }
+
+            void callback_way(OSM::Way *way) {
+                prepare_block(WAY);
+                OSMPBF::Way *pbf_way = group->add_ways();
+                pbf_way->set_id(way->get_id());
+                set_info(pbf_way->mutable_info(), way, string_index(way->get_user()));
+                for (int i=0; i < way->tag_count(); i++) {
+                    pbf_way->add_keys(string_index(way->get_tag_key(i)));
+                    pbf_way->add_vals(string_index(way->get_tag_value(i)));
+                }
+                int64_t last_ref = 0;
+                for (osm_sequence_id_t i=0; i < way->node_count(); i++) {
+                    pbf_way->add_refs(way->nodes[i] - last_ref);
+                    last_ref = way->nodes[i];
+                }
+
+                block_size += 30 + 4 * way->tag_count() + 4 * way->node_count();
+            }
+
+            void callback_relation(OSM::Relation *relation) {
+                prepare_block(RELATION);
+                OSMPBF::Relation *pbf_relation = group->add_relations();
+                pbf_relation->set_id(relation->get_id());
+                set_info(pbf_relation->mutable_info(), relation, string_index(relation->get_user()));
+                for (int i=0; i < relation->tag_count(); i++) {
+                    pbf_relation->add_keys(string_index(relation->get_tag_key(i)));
+                    pbf_relation->add_vals(string_index(relation->get_tag_value(i)));
+                }
+                int64_t last_ref = 0;
+                for (osm_sequence_id_t i=0; i < relation->member_count(); i++) {
+                    const OSM::RelationMember *member = relation->get_member(i);
+                    pbf_relation->add_roles_sid(string_index(member->get_role()));
+                    pbf_relation->add_memids(member->ref - last_ref);
+                    last_ref = member->ref;
+                    switch (member->type) {
+                        case 'n':
+                            pbf_relation->add_types(OSMPBF::Relation::NODE);
+                            break;
+                        case 'w':
+                            pbf_relation->add_types(OSMPBF::Relation::WAY);
+                            break;
+                        default:
+                            pbf_relation->add_types(OSMPBF::Relation::RELATION);
+                            break;
+                    }
+                }
+
+                block_size += 30 + 4 * relation->tag_count() + 8 * relation->member_count();
+            }
+
+            /// write the remaining objects and wait until everything is written
+            void callback_final() {
+                flush_block();
+                if (!workers.empty()) {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    while (!jobs.empty()) {
+                        write_finished_jobs(lock);
+                    }
+                }
+            }
+
+        }; // class PBF
+
+    } // namespace Output
+
+} // namespace Osmium
+
+#endif // OSMIUM_OUTPUT_PBF_HPP
@@ -0,0 +1,408 @@
+#ifndef OSMIUM_OUTPUT_XML_HPP
+#define OSMIUM_OUTPUT_XML_HPP
+
+#include <cerrno>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace Osmium {
+
+    namespace Output {
+
+        /**
+        * Handler writing all objects it gets to an OSM XML file. If the
+        * file name ends in ".gz" the file is compressed with gzip.
+        *
+        * The XML is formatted by hand (no iostreams, no printf) into a
+        * large buffer which is written whenever it is full. With gzip the
+        * full buffers are compressed and written in a separate thread.
+        */
+        class XML : public Handler::Base {
+
+            /// the buffer is written when it gets bigger than this
+            static const size_t buffer_size = 4 * 1024 * 1024;
+
+            /// maximum number of full buffers waiting for the compression thread
+            static const unsigned int max_queue_size = 4;
+
+            int fd;
+            bool gzip;
+
+            std::string buffer;
+
+            z_stream stream;
+            std::string compressed;
+
+            std::thread compressor;
+            std::mutex mutex;
+            std::condition_variable queue_not_empty;
+            std::condition_variable queue_not_full;
+
+            // protected by mutex
+            std::deque<std::string *> queue;
+            bool finished;
+            std::string error;
+
+            XML(const XML &);
+            XML &operator=(const XML &);
+
+            void write_data(const char *data, size_t size) {
+                while (size > 0) {
+                    ssize_t length = ::write(fd, data, size);
+                    if (length < 0) {
+                        throw std::runtime_error(std::string("write error: ") + strerror(errno));
+                    }
+                    data += length;
+                    size -= length;
+                }
+            }
+
+            /// compress data (and finish the gzip stream if flush is Z_FINISH) and write it
+            void deflate_data(const std::string &data, int flush) {
+                stream.next_in  = (Bytef *) data.data();
+                stream.avail_in = data.size();
+                do {
+                    stream.next_out  = (Bytef *) &compressed[0];
+                    stream.avail_out = compressed.size();
+                    if (deflate(&stream, flush) == Z_STREAM_ERROR) {
+                        throw std::runtime_error("gzip compression failed");
+                    }
+                    write_data(compressed.data(), compressed.size() - stream.avail_out);
+                } while (stream.avail_out == 0);
+            }
+
+            void compress_buffers() {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (true) {
+                    while (queue.empty() && !finished) {
+                        queue_not_empty.wait(lock);
+                    }
+                    if (queue.empty()) {
+                        break;
+                    }
+                    std::string *data = queue.front();
+                    queue.pop_front();
+                    queue_not_full.notify_one();
+
+                    // after an error the rest of the data is thrown away
+                    if (error.empty()) {
+                        lock.unlock();
+                        std::string what;
+                        try {
+                            deflate_data(*data, Z_NO_FLUSH);
+                        } catch (std::exception &e) {
+                            what = e.what();
+                        }
+                        lock.lock();
+                        error = what;
+                    }
+                    delete data;
+                }
+
+                if (error.empty()) {
+                    try {
+                        deflate_data(std::string(), Z_FINISH);
+                    } catch (std::exception &e) {
+                        error = e.what();
+                    }
+                }
+            }
+
+            /// write the buffer (or hand it to the compression thread)
+            void flush_buffer() {
+                if (!gzip) {
+                    write_data(buffer.data(), buffer.size());
+                    buffer.clear();
+                    return;
+                }
+
+                std::string *data = new std::string();
+                data->reserve(buffer_size + 64 * 1024);
+                data->swap(buffer);
+
+                std::unique_lock<std::mutex> lock(mutex);
+                if (!error.empty()) {
+                    delete data;
+                    throw std::runtime_error(error);
+                }
+                while (queue.size() >= max_queue_size) {
+                    queue_not_full.wait(lock);
+                }
+                queue.push_back(data);
+                queue_not_empty.notify_one();
+            }
+
+            void check_buffer() {
+                if (buffer.size() >= buffer_size) {
+                    flush_buffer();
+                }
+            }
+
+            void append(const char *s) {
+                buffer.append(s);
+            }
+
+            void append_int(int64_t value) {
+                char digits[24];
+                char *p = digits + sizeof(digits);
+                uint64_t v = value < 0 ? -uint64_t(value) : value;
+                do {
+                    *--p = '0' + v % 10;
+                    v /= 10;
+                } while (v);
+                if (value < 0) {
+                    *--p = '-';
+                }
+                buffer.append(p, digits + sizeof(digits) - p);
+            }
+
+            /// append coordinate with (up to) 7 decimal places, trailing zeros are left out
+            void append_coordinate(double c) {
+                int64_t value = llround(c * 10000000);
+                if (value < 0) {
+                    buffer += '-';
+                    value = -value;
+                }
+                append_int(value / 10000000);
+                int fraction = value % 10000000;
+                if (fraction) {
+                    char digits[8];
+                    digits[0] = '.';
+                    for (int i=7; i > 0; i--) {
+                        digits[i] = '0' + fraction % 10;
+                        fraction /= 10;
+                    }
+                    int length = 8;
+                    while (digits[length-1] == '0') {
+                        length--;
+                    }
+                    buffer.append(digits, length);
+                }
+            }
+
+            void append_escaped(const char *s) {
+                const char *start = s;
+                for (; *s; s++) {
+                    const char *entity;
+                    switch (*s) {
+                        case '&':  entity = "&amp;";  break;
+                        case '"':  entity = "&quot;"; break;
+                        case '\'': entity = "&apos;"; break;
+                        case '<':  entity = "&lt;";   break;
+                        case '>':  entity = "&gt;";   break;
+                        case '\n': entity = "&#xA;";  break;
+                        case '\r': entity = "&#xD;";  break;
+                        case '\t': entity = "&#x9;";  break;
+                        default: continue;
+                    }
+                    buffer.append(start, s - start);
+                    buffer.append(entity);
+                    start = s + 1;
+                }
+                buffer.append(start, s - start);
+            }
+
+            void append_attribute(const char *name, int64_t value) {
+                buffer += ' ';
+                append(name);
+                append("=\"");
+                append_int(value);
+                buffer += '"';
+            }
+
+            void append_attribute(const char *name, const char *value) {
+                buffer += ' ';
+                append(name);
+                append("=\"");
+                append_escaped(value);
+                buffer += '"';
+            }
+
+            /// start tag with the attributes all objects have, unknown attributes are left out
+            void open_object(const char *element, OSM::Object *object) {
+                append("  <");
+                append(element);
+                append_attribute("id", object->get_id());
+                if (object->get_version() > 0) {
+                    append_attribute("version", object->get_version());
+                }
+                if (object->get_timestamp()) {
+                    append_attribute("timestamp", object->get_timestamp_str());
+                }
+                if (object->get_uid() || object->get_user()[0]) {
+                    append_attribute("uid", object->get_uid());
+                    append_attribute("user", object->get_user());
+                }
+                if (object->get_changeset()) {
+                    append_attribute("changeset", object->get_changeset());
+                }
+            }
+
+            void append_tags(OSM::Object *object) {
+                for (int i=0; i < object->tag_count(); i++) {
+                    append("    <tag");
+                    append_attribute("k", object->get_tag_key(i));
+                    append_attribute("v", object->get_tag_value(i));
+                    append("/>\n");
+                }
+            }
+
+          public:
+
+            /**
+            * Open the file for writing (it is overwritten if it exists),
+            * "-" for STDOUT. Files with names ending in ".gz" are
+            * compressed with gzip in a separate thread.
+            */
+            XML(bool debug, const char *filename) : Base(debug), gzip(false), buffer(), compressed(), finished(false) {
+                if (filename[0] == '-' && filename[1] == '\0') {
+                    fd = 1;
+                } else {
+                    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+                    if (fd < 0) {
+                        throw std::runtime_error(std::string("can't open output file '") + filename + "': " + strerror(errno));
+                    }
+                    const size_t length = strlen(filename);
+                    gzip = length > 3 && !strcmp(filename + length - 3, ".gz");
+                }
+
+                buffer.reserve(buffer_size + 64 * 1024);
+
+                if (gzip) {
+                    memset(&stream, 0, sizeof(stream));
+                    // window bits + 16 means gzip instead of zlib format
+                    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                        throw std::runtime_error("can't initialize gzip compression");
+                    }
+                    compressed.resize(256 * 1024);
+                    compressor = std::thread(&XML::compress_buffers, this);
+                }
+            }
+
+            ~XML() {
+                if (compressor.joinable()) {
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        finished = true;
+                    }
+                    queue_not_empty.notify_one();
+                    compressor.join();
+                }
+                for (std::deque<std::string *>::iterator it = queue.begin(); it != queue.end(); it++) {
+                    delete *it;
+                }
+                if (gzip) {
+                    deflateEnd(&stream);
+                }
+                if (fd > 2) {
+                    ::close(fd);
+                }
+            }
+
+            void callback_init() {
+                append("<?xml version='1.0' encoding='UTF-8'?>\n");
+                append("<osm version=\"0.6\" generator=\"Osmium\">\n");
+            }
+
+            void callback_node(OSM::Node *node) {
+                open_object("node", node);
+                if (!std::isnan(node->get_lat()) && !std::isnan(node->get_lon())) {
+                    append(" lat=\"");
+                    append_coordinate(node->get_lat());
+                    append("\" lon=\"");
+                    append_coordinate(node->get_lon());
+                    buffer += '"';
+                }
+                if (node->tag_count() == 0) {
+                    append("/>\n");
+                } else {
+                    append(">\n");
+                    append_tags(node);
+                    append("  </node>\n");
+                }
+                check_buffer();
+            }
+
+            void callback_way(OSM::Way *way) {
+                open_object("way", way);
+                if (way->tag_count() == 0 && way->node_count() == 0) {
+                    append("/>\n");
+                } else {
+                    append(">\n");
+                    for (osm_sequence_id_t i=0; i < way->node_count(); i++) {
+                        append("    <nd");
+                        append_attribute("ref", way->nodes[i]);
+                        append("/>\n");
+                    }
+                    append_tags(way);
+                    append("  </way>\n");
+                }
+                check_buffer();
+            }
+
+            void callback_relation(OSM::Relation *relation) {
+                open_object("relation", relation);
+                if (relation->tag_count() == 0 && relation->member_count() == 0) {
+                    append("/>\n");
+                } else {
+                    append(">\n");
+                    for (osm_sequence_id_t i=0; i < relation->member_count(); i++) {
+                        const OSM::RelationMember *member = relation->get_member(i);
+                        append("    <member type=\"");
+                        switch (member->type) {
+                            case 'n':
+                                append("node");
+                                break;
+                            case 'w':
+                                append("way");
+                                break;
+                            default:
+                                append("relation");
+                                break;
+                        }
+                        buffer += '"';
+                        append_attribute("ref", member->ref);
+                        append_attribute("role", member->get_role());
+                        append("/>\n");
+                    }
+                    append_tags(relation);
+                    append("  </relation>\n");
+                }
+                check_buffer();
+            }
+
+            /// write the rest of the file and wait until everything is written
+            void callback_final() {
+                append("</osm>\n");
+                flush_buffer();
+
+                if (compressor.joinable()) {
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        finished = true;
+                    }
+                    queue_not_empty.notify_one();
+                    compressor.join();
+
+                    if (!error.empty()) {
+                        throw std::runtime_error(error);
+                    }
+                }
+            }
+
+        }; // class XML
+
+    } // namespace Output
+
+} // namespace Osmium
+
+#endif // OSMIUM_OUTPUT_XML_HPP
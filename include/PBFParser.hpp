@@ -35,6 +35,7 @@ namespace Osmium {
         static const int NANO = 1000 * 1000 * 1000;
         static const int MAX_BLOCK_HEADER_SIZE = 64 * 1024;
         static const int MAX_BLOB_SIZE = 32 * 1024 * 1024;
+        static const StringStore::string_id_t NOT_INTERNED = -1;
 
         enum Mode {
             ModeNode, ModeWay, ModeRelation, ModeDense
@@ -134,6 +135,18 @@ namespace Osmium {
             }
         }
 
+        /**
+        * Get the id in Osmium::string_pool() for the string with the given
+        * index in the string table of the current block. Each string is
+        * only looked up in the pool once per block.
+        */
+        StringStore::string_id_t intern_string(int index) {
+            if (m_stringIds[index] == NOT_INTERNED) {
+                m_stringIds[index] = Osmium::string_pool()->intern(m_primitiveBlock.stringtable().s(index).data());
+            }
+            return m_stringIds[index];
+        }
+
         int convertNetworkByteOrder( char data[4] ) {
             return ( ( ( unsigned ) data[0] ) << 24 ) | ( ( ( unsigned ) data[1] ) << 16 ) | ( ( ( unsigned ) data[2] ) << 8 ) | ( unsigned ) data[3];
         }
@@ -145,11 +158,9 @@ namespace Osmium {
             node->id = inputNode.id();
             node->version = inputNode.info().version();
             node->uid = inputNode.info().uid();
-            if (! memccpy(node->user, m_primitiveBlock.stringtable().s(inputNode.info().user_sid()).data(), 0, Osmium::OSM::Object::max_length_username)) {
-                throw std::length_error("user name too long");
-            }
+            node->user_sid = intern_string(inputNode.info().user_sid());
             node->changeset = inputNode.info().changeset();
-            node->timestamp = inputNode.info().timestamp();
+            node->set_timestamp(inputNode.info().timestamp() * m_primitiveBlock.date_granularity() / 1000);
             node->set_coordinates(( ( double ) inputNode.lon() * m_primitiveBlock.granularity() + m_primitiveBlock.lon_offset() ) / NANO,
                                   ( ( double ) inputNode.lat() * m_primitiveBlock.granularity() + m_primitiveBlock.lat_offset() ) / NANO);
             for ( int tag = 0; tag < inputNode.keys_size(); tag++ ) {
@@ -167,11 +178,9 @@ namespace Osmium {
             way->id = inputWay.id();
             way->version = inputWay.info().version();
             way->uid = inputWay.info().uid();
-            if (! memccpy(way->user, m_primitiveBlock.stringtable().s(inputWay.info().user_sid()).data(), 0, Osmium::OSM::Object::max_length_username)) {
-                throw std::length_error("user name too long");
-            }
+            way->user_sid = intern_string(inputWay.info().user_sid());
             way->changeset = inputWay.info().changeset();
-            way->timestamp = inputWay.info().timestamp();
+            way->set_timestamp(inputWay.info().timestamp() * m_primitiveBlock.date_granularity() / 1000);
             for (int tag = 0; tag < inputWay.keys_size(); tag++) {
                 way->add_tag( m_primitiveBlock.stringtable().s( inputWay.keys( tag ) ).data(),
                             m_primitiveBlock.stringtable().s( inputWay.vals( tag ) ).data() );
@@ -193,11 +202,9 @@ namespace Osmium {
             relation->id = inputRelation.id();
             relation->version = inputRelation.info().version();
             relation->uid = inputRelation.info().uid();
-            if (! memccpy(relation->user, m_primitiveBlock.stringtable().s(inputRelation.info().user_sid()).data(), 0, Osmium::OSM::Object::max_length_username)) {
-                throw std::length_error("user name too long");
-            }
+            relation->user_sid = intern_string(inputRelation.info().user_sid());
             relation->changeset = inputRelation.info().changeset();
-            relation->timestamp = inputRelation.info().timestamp();
+            relation->set_timestamp(inputRelation.info().timestamp() * m_primitiveBlock.date_granularity() / 1000);
             for (int tag = 0; tag < inputRelation.keys_size(); tag++) {
                 relation->add_tag( m_primitiveBlock.stringtable().s( inputRelation.keys(tag) ).data(),
                                    m_primitiveBlock.stringtable().s( inputRelation.vals(tag) ).data() );
@@ -218,7 +225,7 @@ namespace Osmium {
                     break;
                 }
                 lastRef += inputRelation.memids(i);
-                relation->add_member(type, lastRef, m_primitiveBlock.stringtable().s( inputRelation.roles_sid( i ) ).data());
+                relation->add_member(type, lastRef, intern_string(inputRelation.roles_sid(i)));
             }
 
             nextEntity(m_primitiveBlock.primitivegroup(m_currentGroup).relations_size());
@@ -238,11 +245,9 @@ namespace Osmium {
             node->id = m_lastDenseID;
             node->version = dense.denseinfo().version( m_currentEntity );
             node->uid = m_lastDenseUID;
-            if (! memccpy(node->user, m_primitiveBlock.stringtable().s( m_lastDenseUserSID ).data(), 0, Osmium::OSM::Object::max_length_username)) {
-                throw std::length_error("user name too long");
-            }
+            node->user_sid = intern_string(m_lastDenseUserSID);
             node->changeset = m_lastDenseChangeset;
-            node->timestamp = m_lastDenseTimestamp;
+            node->set_timestamp(m_lastDenseTimestamp * m_primitiveBlock.date_granularity() / 1000);
             node->set_coordinates(( ( double ) m_lastDenseLongitude * m_primitiveBlock.granularity() + m_primitiveBlock.lon_offset() ) / NANO,
                                   ( ( double ) m_lastDenseLatitude * m_primitiveBlock.granularity() + m_primitiveBlock.lat_offset() ) / NANO);
 
@@ -307,6 +312,7 @@ namespace Osmium {
                     if (!m_primitiveBlock.ParseFromArray(a.data, a.size)) {
                         throw std::runtime_error("failed to parse PrimitiveBlock");
                     }
+                    m_stringIds.assign(m_primitiveBlock.stringtable().s_size(), NOT_INTERNED);
                     return true;
                 }
 
@@ -428,6 +434,9 @@ namespace Osmium {
         std::vector< int > m_wayTagIDs;
         std::vector< int > m_relationTagIDs;
 
+        /// ids in Osmium::string_pool() for the strings in the string table of the current block
+        std::vector< StringStore::string_id_t > m_stringIds;
+
         int64_t m_lastDenseID;
         int64_t m_lastDenseLatitude;
         int64_t m_lastDenseLongitude;
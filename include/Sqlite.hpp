@@ -1,8 +1,15 @@
 #ifndef OSMIUM_SQLITE_HPP
 #define OSMIUM_SQLITE_HPP
 
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <sqlite3.h>
 
@@ -63,6 +70,26 @@ namespace Sqlite {
 
         Statement *prepare(const char *sql);
 
+        /// execute SQL statement(s) without parameters or results
+        void exec(const char *sql) {
+            if (SQLITE_OK != sqlite3_exec(db, sql, 0, 0, 0)) {
+                throw Sqlite::Exception(std::string("Can't execute '") + sql + "'", sqlite3_errmsg(db));
+            }
+        }
+
+        /**
+        * Set pragmas for databases that are written once in bulk and
+        * are simply created again if anything goes wrong: No journal,
+        * no waiting for the disk and a big page cache (size in MB).
+        */
+        void optimize_for_bulk_load(int cache_size_mb=512) {
+            exec("PRAGMA journal_mode=OFF;");
+            exec("PRAGMA synchronous=OFF;");
+            char cache_size[50];
+            snprintf(cache_size, sizeof(cache_size), "PRAGMA cache_size=-%d;", cache_size_mb * 1024);
+            exec(cache_size);
+        }
+
         void begin_transaction();
 
         void commit();
@@ -148,11 +175,11 @@ namespace Sqlite {
     }
 
     inline void Database::begin_transaction() {
-        prepare("BEGIN TRANSACTION;")->execute();
+        exec("BEGIN TRANSACTION;");
     }
 
     inline void Database::commit() {
-        prepare("COMMIT;")->execute();
+        exec("COMMIT;");
     }
 
     inline void Database::close() {
@@ -162,6 +189,331 @@ namespace Sqlite {
         }
     }
 
+    /**
+    *
+    * Writes rows to a database in a separate thread. The values of the
+    * rows are copied into batches which are handed to the writer thread,
+    * so the thread producing them never waits for Sqlite (unless the
+    * writer can't keep up). The rows are written in large transactions.
+    *
+    * Usage is like with Database and Statement:
+    *
+    *   Sqlite::AsyncWriter writer(db);
+    *   Sqlite::AsyncWriter::Statement *insert = writer.prepare("INSERT INTO t (a, b) VALUES (?, ?);");
+    *   insert->bind_text("foo")->bind_int64(17)->execute();
+    *   writer.finish();
+    *
+    * The database must not be used otherwise until finish() returned.
+    * Errors in the writer thread are thrown by execute() or finish(),
+    * all rows after the error are thrown away.
+    *
+    */
+    class AsyncWriter {
+
+    public:
+
+        class Statement;
+
+    private:
+
+        struct value_t {
+            enum { null, integer, text, blob } type;
+            int64_t number; ///< the value for integer, offset in Batch::data for text and blob
+            int length;
+        };
+
+        struct row_t {
+            unsigned int statement;
+            unsigned int first_value;
+            unsigned int num_values;
+        };
+
+        struct Batch {
+            std::vector<row_t>   rows;
+            std::vector<value_t> values;
+            std::string          data; ///< contents of text and blob values
+        };
+
+        /// number of rows collected in a batch before it is handed to the writer thread
+        static const unsigned int batch_size = 10000;
+
+        /// maximum number of batches waiting for the writer thread
+        static const unsigned int max_queue_size = 4;
+
+        Database *db;
+        unsigned int transaction_size;
+
+        /// the statements handed out by prepare(), only used by the producing thread
+        std::vector<Statement *> statements;
+
+        Batch *batch;
+        unsigned int row_first_value;
+
+        std::mutex mutex;
+        std::condition_variable queue_not_empty;
+        std::condition_variable queue_not_full;
+
+        // protected by mutex
+        std::vector<std::string> sql;
+        std::deque<Batch *> queue;
+        bool finished;
+        std::string error;
+
+        std::thread thread;
+
+        AsyncWriter(const AsyncWriter &);
+        AsyncWriter &operator=(const AsyncWriter &);
+
+        /// write the rows of one batch, runs in the writer thread
+        void write(const Batch &b, std::vector<Sqlite::Statement *> &prepared, unsigned int &rows_in_transaction) {
+            for (std::vector<row_t>::const_iterator row = b.rows.begin(); row != b.rows.end(); row++) {
+                if (row->statement >= prepared.size()) {
+                    prepared.resize(row->statement + 1, NULL);
+                }
+                if (!prepared[row->statement]) {
+                    std::string statement_sql;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        statement_sql = sql[row->statement];
+                    }
+                    prepared[row->statement] = db->prepare(statement_sql.c_str());
+                }
+                Sqlite::Statement *statement = prepared[row->statement];
+
+                if (rows_in_transaction == 0) {
+                    db->begin_transaction();
+                }
+
+                for (unsigned int i = row->first_value; i < row->first_value + row->num_values; i++) {
+                    const value_t &value = b.values[i];
+                    switch (value.type) {
+                        case value_t::null:
+                            statement->bind_null();
+                            break;
+                        case value_t::integer:
+                            statement->bind_int64(value.number);
+                            break;
+                        case value_t::text:
+                            statement->bind_text(b.data.data() + value.number);
+                            break;
+                        case value_t::blob:
+                            statement->bind_blob(b.data.data() + value.number, value.length);
+                            break;
+                    }
+                }
+                statement->execute();
+
+                if (++rows_in_transaction >= transaction_size) {
+                    db->commit();
+                    rows_in_transaction = 0;
+                }
+            }
+        }
+
+        void run() {
+            std::vector<Sqlite::Statement *> prepared;
+            unsigned int rows_in_transaction = 0;
+
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                while (queue.empty() && !finished) {
+                    queue_not_empty.wait(lock);
+                }
+                if (queue.empty()) {
+                    break;
+                }
+                Batch *b = queue.front();
+                queue.pop_front();
+                queue_not_full.notify_one();
+
+                if (error.empty()) {
+                    lock.unlock();
+                    std::string what;
+                    try {
+                        write(*b, prepared, rows_in_transaction);
+                    } catch (std::exception &e) {
+                        what = e.what();
+                    }
+                    lock.lock();
+                    error = what;
+                }
+                delete b;
+            }
+
+            for (std::vector<Sqlite::Statement *>::iterator it = prepared.begin(); it != prepared.end(); it++) {
+                delete *it;
+            }
+            if (rows_in_transaction > 0 && error.empty()) {
+                try {
+                    db->commit();
+                } catch (std::exception &e) {
+                    error = e.what();
+                }
+            }
+        }
+
+        /// throw the error from the writer thread if there was one, mutex must be locked
+        void check_error() {
+            if (!error.empty()) {
+                throw Sqlite::Exception("Async writer failed", error);
+            }
+        }
+
+        /// hand the current batch to the writer thread, mutex must be locked
+        void flush(std::unique_lock<std::mutex> &lock) {
+            if (batch->rows.empty()) {
+                return;
+            }
+            while (queue.size() >= max_queue_size) {
+                queue_not_full.wait(lock);
+            }
+            queue.push_back(batch);
+            queue_not_empty.notify_one();
+            batch = new Batch();
+            row_first_value = 0;
+        }
+
+        value_t &add_value() {
+            batch->values.push_back(value_t());
+            return batch->values.back();
+        }
+
+        void add_data(value_t &value, const void *data, int length) {
+            value.number = batch->data.size();
+            value.length = length;
+            batch->data.append(static_cast<const char *>(data), length);
+        }
+
+        void add_row(unsigned int statement) {
+            row_t row;
+            row.statement   = statement;
+            row.first_value = row_first_value;
+            row.num_values  = batch->values.size() - row_first_value;
+            batch->rows.push_back(row);
+            row_first_value = batch->values.size();
+
+            if (batch->rows.size() >= batch_size) {
+                std::unique_lock<std::mutex> lock(mutex);
+                check_error();
+                flush(lock);
+            }
+        }
+
+    public:
+
+        /**
+        * Like Sqlite::Statement, but execute() only queues the row for
+        * the writer thread. The values are copied, so they don't have to
+        * stay around after execute().
+        */
+        class Statement {
+
+            friend class AsyncWriter;
+
+            AsyncWriter *writer;
+            unsigned int id;
+
+            Statement(AsyncWriter *writer, unsigned int id) : writer(writer), id(id) {
+            }
+
+        public:
+
+            Statement *bind_null() {
+                writer->add_value().type = value_t::null;
+                return this;
+            }
+
+            Statement *bind_text(const char *value) {
+                value_t &v = writer->add_value();
+                v.type = value_t::text;
+                writer->add_data(v, value, strlen(value) + 1);
+                return this;
+            }
+
+            Statement *bind_int(int value) {
+                return bind_int64(value);
+            }
+
+            Statement *bind_int64(int64_t value) {
+                value_t &v = writer->add_value();
+                v.type = value_t::integer;
+                v.number = value;
+                return this;
+            }
+
+            Statement *bind_blob(const void *value, int length) {
+                value_t &v = writer->add_value();
+                v.type = value_t::blob;
+                writer->add_data(v, value, length);
+                return this;
+            }
+
+            void execute() {
+                writer->add_row(id);
+            }
+
+        }; // class AsyncWriter::Statement
+
+        /**
+        * Start writer thread for the given database. A transaction is
+        * committed after every transaction_size rows.
+        */
+        AsyncWriter(Database *db, unsigned int transaction_size=1000000) :
+            db(db),
+            transaction_size(transaction_size),
+            statements(),
+            batch(new Batch()),
+            row_first_value(0),
+            sql(),
+            queue(),
+            finished(false),
+            error(),
+            thread(&AsyncWriter::run, this) {
+        }
+
+        ~AsyncWriter() {
+            if (thread.joinable()) {
+                try {
+                    finish();
+                } catch (Sqlite::Exception &) {
+                    // errors are only reported when finish() is called explicitly
+                }
+            }
+            for (std::vector<Statement *>::iterator it = statements.begin(); it != statements.end(); it++) {
+                delete *it;
+            }
+            delete batch;
+        }
+
+        /// prepare statement, it belongs to the writer and must not be deleted
+        Statement *prepare(const char *statement_sql) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                sql.push_back(statement_sql);
+            }
+            statements.push_back(new Statement(this, statements.size()));
+            return statements.back();
+        }
+
+        /// write all remaining rows, commit and stop the writer thread
+        void finish() {
+            if (!thread.joinable()) {
+                return;
+            }
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                flush(lock);
+                finished = true;
+            }
+            queue_not_empty.notify_one();
+            thread.join();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            check_error();
+        }
+
+    }; // class AsyncWriter
+
 } // namespace Sqlite
 
 #endif // OSMIUM_SQLITE_HPP
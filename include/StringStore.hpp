@@ -2,9 +2,34 @@
 #define OSMIUM_STRINGSTORE_HPP
 
 #include <list>
+#include <mutex>
 #include <stdexcept>
 #include <new>
 #include <cstring>
+#include <stdint.h>
+
+#include <google/sparse_hash_map>
+
+/* hash function that seems to work well with tag key/value strings */
+struct djb2_hash {
+    size_t operator()(const char *str) const {
+        size_t hash = 5381;
+        int c;
+
+        while ((c = *str++)) {
+            hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+        }
+
+        return hash;
+    }
+};
+
+/* string comparison for google hash map */
+struct eqstr {
+    bool operator()(const char* s1, const char* s2) const {
+        return (s1 == s2) || (s1 && s2 && strcmp(s1, s2) == 0);
+    }
+};
 
 /*
 
@@ -14,56 +39,156 @@
   If a string is added and there is no space in the current chunk, a new
   chunk will be allocated.
 
+  Strings can also be interned. Interning a string that is already in the
+  store will not copy it again, instead you get back the same small integer
+  id you got the first time. The id can be used to get the string back.
+  Id 0 is always the empty string.
+
+  The store is split into shards. The shard a string goes into is decided
+  by its hash value. Every shard has its own chunks, hash map and lock, so
+  add() and intern() can be called from several threads at the same time
+  and will only block each other if they happen to need the same shard.
+  The lower bits of an id are the shard number, the upper bits count the
+  strings in that shard, so ids are not strictly consecutive, but they
+  are still small and dense enough to be used as index into an array.
+
+  get() doesn't need a lock, because the pointers to interned strings are
+  stored in blocks that are never moved or freed. The id must have been
+  handed to the reading thread in a properly synchronized way (through a
+  queue protected by a mutex for instance), which is always the case if
+  the id was returned by intern() in the same thread.
+
   All memory is released when the destructor is called. There is no other way
   to release all or part of the memory.
 
 */
 class StringStore {
 
-    int chunk_size;
+    public:
 
-    // number of bytes that are available in the current chunk
-    int current_rest_length;
+    typedef uint32_t string_id_t;
 
-    // pointer where the next string is stored
-    char *current_ptr;
+    private:
 
-    // list of chunks
-    std::list<void *> chunks;
+    static const int shard_bits = 4;
+    static const int num_shards = 1 << shard_bits;
 
-    const char *_add_chunk() {
-        current_ptr = (char *) malloc(chunk_size);
-        if (! current_ptr) {
-            throw std::bad_alloc();
+    // pointers to interned strings are stored in blocks of this size
+    static const int index_block_bits = 12;
+    static const int index_block_size = 1 << index_block_bits;
+
+    // this limits the number of strings per shard to 2^24
+    static const int max_index_blocks = 1 << (24 - index_block_bits);
+
+    typedef google::sparse_hash_map<const char *, string_id_t, djb2_hash, eqstr> id_hash_map;
+
+    struct Shard {
+
+        std::mutex mutex;
+
+        // number of bytes that are available in the current chunk
+        int current_rest_length;
+
+        // pointer where the next string is stored
+        char *current_ptr;
+
+        // list of chunks
+        std::list<void *> chunks;
+
+        // number of bytes used by strings (including the null bytes)
+        uint64_t used_bytes;
+
+        // map from interned strings to their ids
+        id_hash_map ids;
+
+        // number of interned strings in this shard
+        string_id_t count;
+
+        // interned strings, indexed by the upper bits of their ids
+        const char **index[max_index_blocks];
+
+        Shard() : current_rest_length(0), current_ptr(NULL), chunks(), used_bytes(0), ids(), count(0) {
+            memset(index, 0, sizeof(index));
         }
-        current_rest_length = chunk_size;
-        chunks.push_back(current_ptr);
-        return current_ptr;
+
+    }; // struct Shard
+
+    int chunk_size;
+
+    Shard shards[num_shards];
+
+    static int shard_num(size_t hash) {
+        // the hash maps in the shards use the lower bits of the same
+        // hash, so we mix the bits and take the shard from the top
+        return (uint32_t(hash) * 2654435761u) >> (32 - shard_bits);
     }
 
-    bool _add(const char *string) {
-        if (current_rest_length <= 1) {
-            _add_chunk();
+    const char *_add_chunk(Shard &shard) {
+        shard.current_ptr = (char *) malloc(chunk_size);
+        if (! shard.current_ptr) {
+            throw std::bad_alloc();
         }
-        char *next_ptr = (char *) memccpy(current_ptr, string, 0, current_rest_length);
+        shard.current_rest_length = chunk_size;
+        shard.chunks.push_back(shard.current_ptr);
+        return shard.current_ptr;
+    }
+
+    bool _add_to_chunk(Shard &shard, const char *string) {
+        char *next_ptr = (char *) memccpy(shard.current_ptr, string, 0, shard.current_rest_length);
         if (next_ptr) {
-            current_rest_length -= (next_ptr - current_ptr);
-            current_ptr = next_ptr;
+            shard.current_rest_length -= (next_ptr - shard.current_ptr);
+            shard.used_bytes += (next_ptr - shard.current_ptr);
+            shard.current_ptr = next_ptr;
             return true;
         }
         return false;
     }
 
+    // Must be called with the lock on the shard held.
+    const char *_add(Shard &shard, const char *string) {
+        if (shard.current_rest_length <= 1) {
+            _add_chunk(shard);
+        }
+        const char *string_ptr = shard.current_ptr;
+
+        if (! _add_to_chunk(shard, string)) {
+            string_ptr = _add_chunk(shard);
+            if (! _add_to_chunk(shard, string)) {
+                throw std::length_error("strings added to StringStore must be shorter than chunk_size");
+            }
+        }
+
+        return string_ptr;
+    }
+
+    // Must be called with the lock on the shard held.
+    void _set_index(Shard &shard, string_id_t n, const char *string) {
+        const string_id_t block = n >> index_block_bits;
+        if (! shard.index[block]) {
+            shard.index[block] = new const char *[index_block_size];
+        }
+        shard.index[block][n & (index_block_size - 1)] = string;
+    }
+
     public:
 
     StringStore(int chunk_size) : chunk_size(chunk_size) {
-        _add_chunk();
+        // the empty string is not stored in any chunk, it always
+        // has id 0, which is the first id in shard 0
+        _set_index(shards[0], 0, "");
+        shards[0].count = 1;
     }
 
     ~StringStore() {
-        while (! chunks.empty()) {
-            free(chunks.back());
-            chunks.pop_back();
+        for (int i=0; i < num_shards; i++) {
+            Shard &shard = shards[i];
+            while (! shard.chunks.empty()) {
+                free(shard.chunks.back());
+                shard.chunks.pop_back();
+            }
+            for (int block=0; block < max_index_blocks && shard.index[block]; block++) {
+                delete[] shard.index[block];
+            }
         }
     }
 
@@ -75,16 +200,76 @@ class StringStore {
     // Throws std::length_error if the string we want to
     // add is longer then the chunk size.
     const char *add(const char *string) {
-        const char *string_ptr = current_ptr;
+        Shard &shard = shards[shard_num(djb2_hash()(string))];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        return _add(shard, string);
+    }
 
-        if (! _add(string)) {
-            string_ptr = _add_chunk();
-            if (! _add(string)) {
-                throw std::length_error("strings added to StringStore must be shorter than chunk_size");
-            }
+    // Intern a null terminated string. If the string is already
+    // in the store its id is returned, otherwise the string is
+    // added and gets a new id.
+    //
+    // Throws std::length_error if there are too many strings
+    // in the store.
+    string_id_t intern(const char *string) {
+        if (string[0] == '\0') {
+            return 0;
         }
 
-        return string_ptr;
+        const int num = shard_num(djb2_hash()(string));
+        Shard &shard = shards[num];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        id_hash_map::const_iterator it = shard.ids.find(string);
+        if (it != shard.ids.end()) {
+            return it->second;
+        }
+
+        if (shard.count == string_id_t(max_index_blocks) * index_block_size) {
+            throw std::length_error("too many strings in StringStore");
+        }
+
+        const char *ptr = _add(shard, string);
+        const string_id_t n = shard.count;
+        _set_index(shard, n, ptr);
+        shard.count++;
+
+        const string_id_t id = (n << shard_bits) | num;
+        shard.ids.insert(std::pair<const char *, string_id_t>(ptr, id));
+        return id;
+    }
+
+    // Get interned string with the given id.
+    const char *get(string_id_t id) const {
+        const Shard &shard = shards[id & (num_shards - 1)];
+        const string_id_t n = id >> shard_bits;
+        return shard.index[n >> index_block_bits][n & (index_block_size - 1)];
+    }
+
+    // Number of interned strings.
+    int get_string_count() {
+        int count = 0;
+        for (int i=0; i < num_shards; i++) {
+            std::lock_guard<std::mutex> lock(shards[i].mutex);
+            count += shards[i].count;
+        }
+        return count;
+    }
+
+    // All ids returned so far are smaller than this. Use it to
+    // size arrays indexed by string id.
+    string_id_t get_max_id() {
+        string_id_t max_id = 0;
+        for (int i=0; i < num_shards; i++) {
+            std::lock_guard<std::mutex> lock(shards[i].mutex);
+            if (shards[i].count > 0) {
+                const string_id_t next = ((shards[i].count - 1) << shard_bits) + i + 1;
+                if (next > max_id) {
+                    max_id = next;
+                }
+            }
+        }
+        return max_id;
     }
 
     // These functions get you some idea how much memory was
@@ -93,12 +278,38 @@ class StringStore {
         return chunk_size;
     }
 
-    int get_chunk_count() const {
-        return chunks.size();
+    int get_chunk_count() {
+        int count = 0;
+        for (int i=0; i < num_shards; i++) {
+            std::lock_guard<std::mutex> lock(shards[i].mutex);
+            count += shards[i].chunks.size();
+        }
+        return count;
     }
 
-    int get_used_bytes_in_last_chunk() const {
-        return chunk_size - current_rest_length;
+    // Bytes used by the strings themselves (including the null bytes).
+    uint64_t get_used_bytes() {
+        uint64_t bytes = 0;
+        for (int i=0; i < num_shards; i++) {
+            std::lock_guard<std::mutex> lock(shards[i].mutex);
+            bytes += shards[i].used_bytes;
+        }
+        return bytes;
+    }
+
+    // Estimated memory used by the store: chunks, index blocks and
+    // hash maps (assuming about 2.5 bits overhead per bucket for
+    // the sparse hash maps).
+    uint64_t get_memory_usage() {
+        uint64_t bytes = sizeof(StringStore);
+        for (int i=0; i < num_shards; i++) {
+            std::lock_guard<std::mutex> lock(shards[i].mutex);
+            const Shard &shard = shards[i];
+            bytes += uint64_t(shard.chunks.size()) * chunk_size;
+            bytes += uint64_t((shard.count + index_block_size - 1) / index_block_size) * index_block_size * sizeof(const char *);
+            bytes += (sizeof(const char *) * 8 + sizeof(string_id_t) * 8 + 3) * shard.ids.bucket_count() / 8;
+        }
+        return bytes;
     }
 
 };
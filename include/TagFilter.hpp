@@ -0,0 +1,103 @@
+#ifndef OSMIUM_TAGFILTER_HPP
+#define OSMIUM_TAGFILTER_HPP
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace Osmium {
+
+    /**
+    * Checks whether an object has any of a list of tags. Each entry in
+    * the filter is a key, either with any value or with a list of
+    * allowed values. An object matches if at least one of its tags
+    * matches one of the entries, so objects without tags never match.
+    *
+    * A filter nothing was added to (not even an empty list of keys,
+    * see enable()) lets all objects through.
+    */
+    class TagFilter {
+
+        struct Entry {
+            std::string key;
+            bool any_value;
+            std::vector<std::string> values;
+
+            Entry(const char *key) : key(key), any_value(false), values() {
+            }
+        };
+
+        std::vector<Entry> entries;
+
+        bool enabled;
+
+        Entry &entry(const char *key) {
+            for (std::vector<Entry>::iterator it = entries.begin(); it != entries.end(); it++) {
+                if (it->key == key) {
+                    return *it;
+                }
+            }
+            entries.push_back(Entry(key));
+            return entries.back();
+        }
+
+        bool match_tag(const char *key, const char *value) const {
+            for (std::vector<Entry>::const_iterator it = entries.begin(); it != entries.end(); it++) {
+                if (!strcmp(it->key.c_str(), key)) {
+                    if (it->any_value) {
+                        return true;
+                    }
+                    for (std::vector<std::string>::const_iterator v = it->values.begin(); v != it->values.end(); v++) {
+                        if (!strcmp(v->c_str(), value)) {
+                            return true;
+                        }
+                    }
+                    return false;
+                }
+            }
+            return false;
+        }
+
+      public:
+
+        TagFilter() : entries(), enabled(false) {
+        }
+
+        /// from now on only objects matching the entries are let through
+        void enable() {
+            enabled = true;
+        }
+
+        bool is_enabled() const {
+            return enabled;
+        }
+
+        /// let objects with this key through, whatever the value
+        void add_key(const char *key) {
+            enable();
+            entry(key).any_value = true;
+        }
+
+        /// let objects with this tag through
+        void add_tag(const char *key, const char *value) {
+            enable();
+            entry(key).values.push_back(value);
+        }
+
+        bool match(const OSM::Object *object) const {
+            if (!enabled) {
+                return true;
+            }
+            for (int i=0; i < object->tag_count(); i++) {
+                if (match_tag(object->get_tag_key(i), object->get_tag_value(i))) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    }; // class TagFilter
+
+} // namespace Osmium
+
+#endif // OSMIUM_TAGFILTER_HPP
@@ -0,0 +1,129 @@
+#ifndef OSMIUM_TIMESTAMP_HPP
+#define OSMIUM_TIMESTAMP_HPP
+
+#include <cstring>
+#include <stdexcept>
+#include <stdint.h>
+#include <time.h>
+
+namespace Osmium {
+
+    /**
+    *
+    * Conversion between OSM timestamps in ISO 8601 format
+    * ("2010-09-30T12:34:56Z") and seconds since the epoch.
+    *
+    * OSM timestamps always have exactly this format and are always in
+    * UTC, so we don't need strptime/mktime or gmtime/strftime. Those are
+    * slow and mktime would interpret the time in the local timezone.
+    *
+    */
+    class Timestamp {
+
+        /// parse n digits, returns -1 if there is something that is not a digit
+        static int parse_digits(const char *str, int n) {
+            int value = 0;
+            for (int i=0; i < n; i++) {
+                if (str[i] < '0' || str[i] > '9') {
+                    return -1;
+                }
+                value = value * 10 + (str[i] - '0');
+            }
+            return value;
+        }
+
+        static void format_digits(char *str, int n, int value) {
+            for (int i=n-1; i >= 0; i--) {
+                str[i] = '0' + value % 10;
+                value /= 10;
+            }
+        }
+
+        // The following two functions convert between days since the epoch
+        // and year/month/day in the proleptic Gregorian calendar. See
+        // http://howardhinnant.github.io/date_algorithms.html for details.
+
+        static int64_t days_from_civil(int y, int m, int d) {
+            y -= m <= 2;
+            const int64_t era = (y >= 0 ? y : y-399) / 400;
+            const int yoe = y - era * 400;                                  // [0, 399]
+            const int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1; // [0, 365]
+            const int doe = yoe * 365 + yoe/4 - yoe/100 + doy;              // [0, 146096]
+            return era * 146097 + doe - 719468;
+        }
+
+        static void civil_from_days(int64_t z, int &y, int &m, int &d) {
+            z += 719468;
+            const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+            const int doe = z - era * 146097;                                // [0, 146096]
+            const int yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365; // [0, 399]
+            const int doy = doe - (365*yoe + yoe/4 - yoe/100);               // [0, 365]
+            const int mp = (5*doy + 2)/153;                                  // [0, 11]
+            d = doy - (153*mp+2)/5 + 1;
+            m = mp + (mp < 10 ? 3 : -9);
+            y = yoe + era * 400 + (m <= 2);
+        }
+
+      public:
+
+        static const int max_length = 20 + 1; ///< length of timestamp string (20 characters + null byte)
+
+        /**
+        * Parse timestamp string in the format "yyyy-mm-ddThh:mm:ssZ".
+        *
+        * Throws std::invalid_argument if the string is not in this format.
+        */
+        static time_t parse(const char *str) {
+            if (strlen(str) != max_length - 1 || str[4] != '-' || str[7] != '-' || str[10] != 'T' || str[13] != ':' || str[16] != ':' || str[19] != 'Z') {
+                throw std::invalid_argument("can not parse timestamp");
+            }
+
+            const int year   = parse_digits(str,      4);
+            const int month  = parse_digits(str +  5, 2);
+            const int day    = parse_digits(str +  8, 2);
+            const int hour   = parse_digits(str + 11, 2);
+            const int minute = parse_digits(str + 14, 2);
+            const int second = parse_digits(str + 17, 2);
+
+            if (year < 0 || month < 1 || month > 12 || day < 1 || day > 31 || hour < 0 || hour > 23 || minute < 0 || minute > 59 || second < 0 || second > 60) {
+                throw std::invalid_argument("can not parse timestamp");
+            }
+
+            return days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+        }
+
+        /**
+        * Write timestamp as string in the format "yyyy-mm-ddThh:mm:ssZ" into
+        * the buffer. The buffer must have room for max_length characters.
+        */
+        static void to_iso(time_t timestamp, char *buffer) {
+            int64_t days    = timestamp / 86400;
+            int     seconds = timestamp % 86400;
+            if (seconds < 0) {
+                seconds += 86400;
+                days--;
+            }
+
+            int year, month, day;
+            civil_from_days(days, year, month, day);
+
+            format_digits(buffer,      4, year);
+            buffer[4] = '-';
+            format_digits(buffer +  5, 2, month);
+            buffer[7] = '-';
+            format_digits(buffer +  8, 2, day);
+            buffer[10] = 'T';
+            format_digits(buffer + 11, 2, seconds / 3600);
+            buffer[13] = ':';
+            format_digits(buffer + 14, 2, (seconds / 60) % 60);
+            buffer[16] = ':';
+            format_digits(buffer + 17, 2, seconds % 60);
+            buffer[19] = 'Z';
+            buffer[20] = '\0';
+        }
+
+    }; // class Timestamp
+
+} // namespace Osmium
+
+#endif // OSMIUM_TIMESTAMP_HPP
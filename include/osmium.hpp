@@ -34,6 +34,11 @@ enum osm_object_type_t {
 #define STR_TO_USER_ID(x)      (atol(x))
 #define STR_TO_SEQUENCE_ID(x)  (atoi(x))
 
+namespace Osmium {
+    /// string store shared by all objects, used for user names and relation member roles
+    StringStore *string_pool();
+} // namespace Osmium
+
 struct node_coordinates {
     double lon;
     double lat;
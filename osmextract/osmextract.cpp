@@ -0,0 +1,153 @@
+
+#include <getopt.h>
+
+#include <osmium.hpp>
+#include <HandlerExtract.hpp>
+
+Osmium::Handler::Extract *osmium_handler_extract;
+
+void init_handler() {
+    osmium_handler_extract->callback_init();
+}
+
+void node_handler(Osmium::OSM::Node *node) {
+    osmium_handler_extract->callback_node(node);
+}
+
+void way_handler(Osmium::OSM::Way *way) {
+    osmium_handler_extract->callback_way(way);
+}
+
+void relation_handler(Osmium::OSM::Relation *relation) {
+    osmium_handler_extract->callback_relation(relation);
+}
+
+void final_handler() {
+    osmium_handler_extract->callback_final();
+}
+
+struct callbacks *setup_callbacks() {
+    static struct callbacks cb;
+    cb.init     = init_handler;
+    cb.node     = node_handler;
+    cb.way      = way_handler;
+    cb.relation = relation_handler;
+    cb.final    = final_handler;
+    return &cb;
+}
+
+void print_help() {
+    std::cout << "osmextract [OPTIONS] OSMFILE" << std::endl \
+              << "Cut extracts of OSMFILE (.osm or .pbf, sorted by type and id)." << std::endl \
+              << "Each --output writes one extract of the region given before it," << std::endl \
+              << "as PBF if FILE ends in .pbf, as XML otherwise (gzipped for .gz)." << std::endl \
+              << "Options:" << std::endl \
+              << "  --help, -h                       - This help message" << std::endl \
+              << "  --debug, -d                      - Enable debugging output" << std::endl \
+              << "  --bbox=L,B,R,T, -b L,B,R,T       - Region is this bounding box" << std::endl \
+              << "  --polygon=FILE, -p FILE          - Region is this polygon (osmosis .poly format)" << std::endl \
+              << "  --output=FILE, -o FILE           - Write extract of the region to FILE" << std::endl \
+              << "  --complete-ways, -c              - Add all nodes of the ways (reads OSMFILE twice)" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    bool debug = false;
+    bool complete_ways = false;
+
+    // regions and the files their extracts go to, in command line order
+    std::vector<Osmium::Handler::Extract::Region *> regions;
+    std::vector<const char *> filenames;
+    Osmium::Handler::Extract::Region *region = NULL;
+
+    static struct option long_options[] = {
+        {"help",          no_argument,       0, 'h'},
+        {"debug",         no_argument,       0, 'd'},
+        {"bbox",          required_argument, 0, 'b'},
+        {"polygon",       required_argument, 0, 'p'},
+        {"output",        required_argument, 0, 'o'},
+        {"complete-ways", no_argument,       0, 'c'},
+        {0, 0, 0, 0}
+    };
+
+    while (1) {
+        int c = getopt_long(argc, argv, "hdb:p:o:c", long_options, 0);
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case 'h':
+                print_help();
+                exit(0);
+            case 'd':
+                debug = true;
+                break;
+            case 'b': {
+                double left, bottom, right, top;
+                if (sscanf(optarg, "%lf,%lf,%lf,%lf", &left, &bottom, &right, &top) != 4 || left > right || bottom > top) {
+                    std::cerr << "Invalid bounding box: " << optarg << " (expected LEFT,BOTTOM,RIGHT,TOP)" << std::endl;
+                    exit(1);
+                }
+                delete region;
+                region = new Osmium::Handler::Extract::Bbox(left, bottom, right, top);
+                break;
+            }
+            case 'p':
+                delete region;
+                try {
+                    region = new Osmium::Handler::Extract::Polygon(optarg);
+                } catch (const std::runtime_error &e) {
+                    std::cerr << e.what() << std::endl;
+                    exit(1);
+                }
+                break;
+            case 'o':
+                if (!region) {
+                    std::cerr << "--output " << optarg << " needs a --bbox or --polygon before it" << std::endl;
+                    exit(1);
+                }
+                regions.push_back(region);
+                filenames.push_back(optarg);
+                region = NULL;
+                break;
+            case 'c':
+                complete_ways = true;
+                break;
+            default:
+                exit(1);
+        }
+    }
+
+    if (region) {
+        std::cerr << "Region without --output after it" << std::endl;
+        exit(1);
+    }
+
+    if (optind != argc-1 || regions.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [OPTIONS] OSMFILE (see --help)" << std::endl;
+        exit(1);
+    }
+
+    Osmium::OSM::Node     *node     = new Osmium::OSM::Node;
+    Osmium::OSM::Way      *way      = new Osmium::OSM::Way;
+    Osmium::OSM::Relation *relation = new Osmium::OSM::Relation;
+
+    try {
+        osmium_handler_extract = new Osmium::Handler::Extract(debug, complete_ways);
+        for (unsigned int i=0; i < regions.size(); i++) {
+            osmium_handler_extract->add_extract(regions[i], filenames[i]);
+        }
+
+        // the handler needs the input once per pass, see Osmium::Handler::Extract
+        for (int pass=0; pass < osmium_handler_extract->passes(); pass++) {
+            parse_osmfile(debug, argv[optind], setup_callbacks(), node, way, relation);
+        }
+    } catch (const std::runtime_error &e) {
+        std::cerr << e.what() << std::endl;
+        exit(1);
+    }
+
+    delete osmium_handler_extract;
+
+    return 0;
+}
+
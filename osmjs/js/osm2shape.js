@@ -19,6 +19,13 @@ var rules = {
     area: []
 };
 
+// tags used in the rules, the callbacks are only called for objects with these tags
+var filters = {
+    node: {},
+    way:  {},
+    area: {}
+};
+
 function shapefile(name) {
     var shp = {
         name: name,
@@ -60,10 +67,20 @@ function shapefile(name) {
 }
 
 
+function add_filter(type, key, value) {
+    var filter = filters[type];
+    if (value == null || filter[key] === true) {
+        filter[key] = true;
+    } else {
+        filter[key] = (filter[key] || []).concat(value.split('|'));
+    }
+}
+
 function rule(type, key, value) {
     if (value == '*') {
         value = null;
     }
+    add_filter(type, key, value);
     var rule = {
         type: type,
         key: key,
@@ -204,14 +221,17 @@ function check(type, osm_object) {
 Osmium.Callbacks.node = function() {
     check('node', this);
 }
+Osmium.Callbacks.node.filter = filters.node;
 
 Osmium.Callbacks.way = function() {
     check('way', this);
 }
+Osmium.Callbacks.way.filter = filters.way;
 
 Osmium.Callbacks.multipolygon = function() {
     check('area', this);
 }
+Osmium.Callbacks.multipolygon.filter = filters.area;
 
 Osmium.Callbacks.end = function() {
     for (var file in files) {
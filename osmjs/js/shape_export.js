@@ -35,6 +35,7 @@ Osmium.Callbacks.node = function() {
         }
     }
 }
+Osmium.Callbacks.node.filter = { amenity: ['restaurant', 'pub'], shop: 'supermarket' };
 
 Osmium.Callbacks.way = function() {
     if (this.tags.highway) {
@@ -50,12 +51,14 @@ Osmium.Callbacks.way = function() {
         shp_roads.add(this, { id: this.id, type: this.tags.highway, name: this.tags.name, oneway: oneway, maxspeed: maxspeed });
     }
 }
+Osmium.Callbacks.way.filter = { highway: true };
 
 Osmium.Callbacks.multipolygon = function() {
     if (this.tags.landuse) {
         shp_landuse.add(this, { id: this.id, type: this.tags.landuse });
     }
 }
+Osmium.Callbacks.multipolygon.filter = { landuse: true };
 
 Osmium.Callbacks.end = function() {
     shp_pois.close();
@@ -2,6 +2,7 @@
 #include <getopt.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <thread>
 
 #include "osmium.hpp"
 
@@ -129,6 +130,9 @@ void print_help() {
               << "  --location-store=STORE, -l STORE - Set location store (default: 'sparsetable')" << std::endl \
               << "  --no-repair, -r                  - Do not attempt to repair broken multipolygons" << std::endl \
               << "  --2pass, -2                      - Read OSMFILE twice and build multipolygons" << std::endl \
+              << "  --threads=N, -t N                - Build multipolygons in N threads, the callback order is then not deterministic (default: 0)" << std::endl \
+              << "  --mp-memory=MB, -m MB            - Spill incomplete multipolygons to disk if they need more memory (default: unlimited)" << std::endl \
+              << "  --mp-profile=N, -p N             - Print multipolygon build times and the N slowest relations at the end" << std::endl \
               << "Location stores:" << std::endl \
               << "  array       - Store node locations in large array (use for large OSM files)" << std::endl \
               << "  disk        - Store node locations on disk (use when low on memory)" << std::endl \
@@ -171,6 +175,9 @@ int main(int argc, char *argv[]) {
     bool debug = false;
     bool two_passes = false;
     bool attempt_repair = true;
+    int num_threads = 0;
+    uint64_t mp_memory = 0;
+    int mp_profile = -1;
     char javascript_filename[512] = "";
     char *osm_filename;
     std::vector<std::string> include_files;
@@ -188,11 +195,14 @@ int main(int argc, char *argv[]) {
         {"location-store", required_argument, 0, 'l'},
         {"no-repair",            no_argument, 0, 'r'},
         {"2pass",                no_argument, 0, '2'},
+        {"threads",        required_argument, 0, 't'},
+        {"mp-memory",      required_argument, 0, 'm'},
+        {"mp-profile",     required_argument, 0, 'p'},
         {0, 0, 0, 0}
     };
 
     while (1) {
-        int c = getopt_long(argc, argv, "dhi:j:l:r2", long_options, 0);
+        int c = getopt_long(argc, argv, "dhi:j:l:r2t:m:p:", long_options, 0);
         if (c == -1)
             break;
 
@@ -229,6 +239,15 @@ int main(int argc, char *argv[]) {
             case '2':
                 two_passes = true;
                 break;
+            case 't':
+                num_threads = atoi(optarg);
+                break;
+            case 'm':
+                mp_memory = uint64_t(atoi(optarg)) * 1024 * 1024;
+                break;
+            case 'p':
+                mp_profile = atoi(optarg);
+                break;
             default:
                 exit(1);
         }
@@ -275,7 +294,10 @@ int main(int argc, char *argv[]) {
     }
     osmium_handler_javascript = new Osmium::Handler::Javascript(debug, include_files, javascript_filename);
     if (two_passes) {
-        osmium_handler_multipolygon = new Osmium::Handler::Multipolygon(debug, attempt_repair, callbacks_2nd_pass);
+        osmium_handler_multipolygon = new Osmium::Handler::Multipolygon(debug, attempt_repair, callbacks_2nd_pass, num_threads, mp_memory);
+        if (mp_profile >= 0) {
+            osmium_handler_multipolygon->enable_profiling(mp_profile);
+        }
     }
 
     Osmium::Javascript::Node::Wrapper     *wrap_node     = new Osmium::Javascript::Node::Wrapper;
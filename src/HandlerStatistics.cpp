@@ -38,6 +38,18 @@ namespace Osmium {
                 0    // last element must always be 0
             };
 
+            // if you change anything in this array, also change the corresponding enum in Statistics.hpp
+            const char *Statistics::histogram_names[] = {
+                "node_tags",
+                "way_tags",
+                "relation_tags",
+                "way_nodes",
+                "relation_members",
+                "node_version",
+                "way_version",
+                "relation_version"
+            };
+
     } // namespace Handler
 
 } // namespace Osmium
@@ -40,6 +40,10 @@ namespace Osmium {
                 return js_template_tags->create_instance(wrapper);
             }
 
+            v8::Local<v8::Object> create_tags_object(Osmium::OSM::Object *object) {
+                return js_template_tags->create_tags_object(object);
+            }
+
             v8::Local<v8::Object> create_node_geom_instance(void *wrapper) {
                 return js_template_nodegeom->create_instance(wrapper);
             }
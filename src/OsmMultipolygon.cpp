@@ -4,16 +4,14 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <vector>
+#include <algorithm>
 #include <sstream>
 #include <iomanip>
 
-#ifdef WITH_MULTIPOLYGON_PROFILING
-#define START_TIMER(x) x##_timer.start();
-#define STOP_TIMER(x) x##_timer.stop();
-#else
-#define START_TIMER(x)
-#define STOP_TIMER(x)
-#endif
+// the profiling statistics are only collected if stats is set (see build())
+#define START_TIMER(x) do { if (stats) stats->start(MultipolygonBuildStats::x); } while (0)
+#define STOP_TIMER(x) do { if (stats) stats->stop(MultipolygonBuildStats::x); } while (0)
+#define COUNT_GEOS_OP() do { if (stats) stats->geos_ops++; } while (0)
 
 #include "osmium.hpp"
 
@@ -32,6 +30,7 @@
 #include <geos/algorithm/LineIntersector.h>
 #include <geos/geomgraph/GeometryGraph.h>
 #include <geos/geomgraph/index/SegmentIntersector.h>
+#include <geos/index/strtree/STRtree.h>
 
 // this should come from /usr/include/geos/algorithm, but its missing there in some Ubuntu versions
 #include "../include/CGAlgorithms.h"
@@ -43,10 +42,6 @@ namespace Osmium {
 
     namespace OSM {
 
-#ifdef WITH_MULTIPOLYGON_PROFILING
-        std::vector<std::pair<std::string, timer *> > MultipolygonFromRelation::timers;
-#endif
-
         bool ignore_tag(const std::string &s) {
             if (s=="type") return true;
             if (s=="created_by") return true;
@@ -204,128 +199,302 @@ namespace Osmium {
         }
 
         /**
-        * Tries to collect 1...n ways from the n ways in the given list so that
-        * they form a closed ring. If this is possible, flag those as being used
-        * by ring #ringcount in the way list and return the geometry. (The method
-        * may be called again to find further rings.) If this is not possible, 
-        * return NULL.
+        * Helper for ring_is_simple(): Geometric predicates on the points
+        * of a ring given as arrays of x and y coordinates.
         */
-        RingInfo *MultipolygonFromRelation::make_one_ring(std::vector<WayInfo *> &ways, osm_object_id_t first, osm_object_id_t last, int ringcount, int sequence)
+        class RingPoints {
+
+            const double *x;
+            const double *y;
+
+          public:
+
+            RingPoints(const double *x, const double *y) : x(x), y(y) {
+            }
+
+            /**
+            * Orientation of point c relative to the line through a and b.
+            * Positive if c is left of the line, negative if it is right of
+            * it and zero if the points are collinear.
+            */
+            double orientation(int a, int b, int c) const {
+                return (x[b] - x[a]) * (y[c] - y[a]) - (y[b] - y[a]) * (x[c] - x[a]);
+            }
+
+            /** is c, which is collinear with a and b, on the segment a-b? */
+            bool on_segment(int a, int b, int c) const {
+                return std::min(x[a], x[b]) <= x[c] && x[c] <= std::max(x[a], x[b]) &&
+                       std::min(y[a], y[b]) <= y[c] && y[c] <= std::max(y[a], y[b]);
+            }
+
+            bool segments_intersect(int p1, int p2, int p3, int p4) const {
+                const double d1 = orientation(p3, p4, p1);
+                const double d2 = orientation(p3, p4, p2);
+                const double d3 = orientation(p1, p2, p3);
+                const double d4 = orientation(p1, p2, p4);
+
+                if (((d1 > 0 && d2 < 0) || (d1 < 0 && d2 > 0)) && ((d3 > 0 && d4 < 0) || (d3 < 0 && d4 > 0))) return true;
+
+                return (d1 == 0 && on_segment(p3, p4, p1)) ||
+                       (d2 == 0 && on_segment(p3, p4, p2)) ||
+                       (d3 == 0 && on_segment(p1, p2, p3)) ||
+                       (d4 == 0 && on_segment(p1, p2, p4));
+            }
+
+            /** do the neighbouring segments a-b and b-c fold back onto each other? */
+            bool folds_back(int a, int b, int c) const {
+                return orientation(a, b, c) == 0 && (on_segment(a, b, c) || on_segment(b, c, a));
+            }
+
+            double min_x(int segment) const { return std::min(x[segment], x[segment+1]); }
+            double max_x(int segment) const { return std::max(x[segment], x[segment+1]); }
+            double min_y(int segment) const { return std::min(y[segment], y[segment+1]); }
+            double max_y(int segment) const { return std::max(y[segment], y[segment+1]); }
+
+            bool operator()(int a, int b) const {
+                return min_x(a) < min_x(b);
+            }
+
+        }; // class RingPoints
+
+        /**
+        * The segments are sorted by their smallest x coordinate, so each
+        * segment only has to be compared with the segments overlapping it
+        * in x direction.
+        */
+        bool ring_is_simple(const double *x, const double *y, int num_points)
         {
+            const int num_segments = num_points - 1;
+            if (num_segments < 3) return false;
+
+            const RingPoints p(x, y);
 
-            // have we found a loop already?
-            if (first && first == last)
+            std::vector<int> segments(num_segments);
+            for (int i=0; i < num_segments; i++) segments[i] = i;
+            std::sort(segments.begin(), segments.end(), p);
+
+            for (int n=0; n < num_segments; n++)
             {
-                geos::geom::CoordinateSequence *cs = geos::geom::CoordinateArraySequenceFactory::instance()->create(0, 0);
-                geos::geom::LinearRing *lr = NULL;
-                try
+                const int i = segments[n];
+                for (int m=n+1; m < num_segments; m++)
                 {
-                    START_TIMER(mor_polygonizer);
-                    WayInfo **sorted_ways = new WayInfo*[sequence];
-                    for (unsigned int i=0; i<ways.size(); i++)
+                    const int j = segments[m];
+                    if (p.min_x(j) > p.max_x(i)) break;
+                    if (p.max_y(j) < p.min_y(i) || p.min_y(j) > p.max_y(i)) continue;
+
+                    const int first  = std::min(i, j);
+                    const int second = std::max(i, j);
+                    if (second == first + 1)
                     {
-                        if (ways[i]->used == ringcount) 
-                        {
-                            sorted_ways[ways[i]->sequence] = ways[i];
-                        }
+                        // neighbouring segments share point second
+                        if (p.folds_back(first, second, second+1)) return false;
                     }
-                    for (int i=0; i<sequence; i++)
+                    else if (first == 0 && second == num_segments - 1)
                     {
-                        cs->add(((geos::geom::LineString *)sorted_ways[i]->way_geom)->getCoordinatesRO(), false, !sorted_ways[i]->invert);
+                        // first and last segment share point 0
+                        if (p.folds_back(second, 0, 1)) return false;
                     }
-                    delete[] sorted_ways;
-                    lr = Osmium::geos_factory()->createLinearRing(cs);
-                    STOP_TIMER(mor_polygonizer);
-                    if (!lr->isSimple() || !lr->isValid())
-                    { 
-                        //delete lr;
-                        lr = NULL;
-                        if (attempt_repair)
-                        {
-                            lr = create_non_intersecting_linear_ring(cs);
-                            if (lr)
-                            {
-                                if (debug) 
-                                    std::cerr << "successfully repaired an invalid ring" << std::endl;
-                            }
-                        }
-                        if (!lr) return NULL; 
+                    else if (p.segments_intersect(i, i+1, j, j+1))
+                    {
+                        return false;
                     }
-                    bool ccw = geos::algorithm::CGAlgorithms::isCCW(lr->getCoordinatesRO());
-                    RingInfo *rl = new RingInfo();
-                    rl->direction = ccw ? COUNTERCLOCKWISE : CLOCKWISE;
-                    rl->polygon = Osmium::geos_factory()->createPolygon(lr, NULL);
-                    return rl;
                 }
-                catch (const geos::util::GEOSException& exc) 
+            }
+
+            return true;
+        }
+
+        double ring_area(const double *x, const double *y, int num_points)
+        {
+            double area = 0;
+            for (int i=0; i < num_points - 1; i++)
+            {
+                area += x[i] * y[i+1] - x[i+1] * y[i];
+            }
+            return area / 2;
+        }
+
+        /**
+        * Builds the ring from the given ways in the given order (using
+        * their invert flags). Returns NULL if this doesn't give a valid
+        * ring and it can't be repaired.
+        *
+        * Only if the ring is not simple will GEOS be used to try to
+        * repair it, for the normal case the coordinates are checked
+        * and the orientation is calculated (shoelace formula) here.
+        */
+        RingInfo *MultipolygonFromRelation::make_ring_from_ways(std::vector<WayInfo *> &ways, const std::vector<int> &sequence)
+        {
+            START_TIMER(mor_polygonizer);
+            std::vector<geos::geom::Coordinate> *coords = new std::vector<geos::geom::Coordinate>();
+            for (std::vector<int>::const_iterator w = sequence.begin(); w != sequence.end(); w++)
+            {
+                const std::vector<geos::geom::Coordinate> &wc = ways[*w]->coordinates;
+                for (unsigned int i=0; i < wc.size(); i++)
                 {
-                    if (debug)
-                        std::cerr << "Exception: " << exc.what() << std::endl;
-                    return NULL;
+                    const geos::geom::Coordinate &c = ways[*w]->invert ? wc[wc.size() - 1 - i] : wc[i];
+                    if (coords->empty() || !coords->back().equals2D(c))
+                    {
+                        coords->push_back(c);
+                    }
                 }
             }
 
-            // have we not allocated anything yet, then simply start with first available way, 
-            // or return NULL if all are taken.
-            if (!first)
+            if (coords->size() < 4)
+            {
+                STOP_TIMER(mor_polygonizer);
+                delete coords;
+                return NULL;
+            }
+
+            try
             {
-                for (unsigned int i=0; i<ways.size(); i++)
+                geos::geom::LinearRing *lr = NULL;
+                bool ccw;
+                std::vector<double> x(coords->size());
+                std::vector<double> y(coords->size());
+                for (unsigned int i=0; i < coords->size(); i++)
                 {
-                    if (ways[i]->used != -1) continue;
-                    ways[i]->used = ringcount;
-                    ways[i]->sequence = 0;
-                    ways[i]->invert = false;
-                    RingInfo *rl = make_one_ring(ways, ways[i]->firstnode, ways[i]->lastnode, ringcount, 1);
-                    if (rl)
+                    x[i] = (*coords)[i].x;
+                    y[i] = (*coords)[i].y;
+                }
+                if (ring_is_simple(&x[0], &y[0], coords->size()))
+                {
+                    ccw = ring_area(&x[0], &y[0], coords->size()) > 0;
+                    lr = Osmium::geos_factory()->createLinearRing(Osmium::geos_factory()->getCoordinateSequenceFactory()->create(coords));
+                    STOP_TIMER(mor_polygonizer);
+                }
+                else
+                {
+                    STOP_TIMER(mor_polygonizer);
+                    geos::geom::CoordinateSequence *cs = Osmium::geos_factory()->getCoordinateSequenceFactory()->create(coords);
+                    if (attempt_repair)
                     {
-                        rl->ways.push_back(ways[i]);
-                        return rl;
+                        COUNT_GEOS_OP();
+                        lr = create_non_intersecting_linear_ring(cs);
+                        if (lr)
+                        {
+                            if (debug) 
+                                std::cerr << "successfully repaired an invalid ring" << std::endl;
+                        }
                     }
-                    ways[i]->used = -2;
-                    break;
+                    delete cs;
+                    if (!lr) return NULL;
+                    ccw = geos::algorithm::CGAlgorithms::isCCW(lr->getCoordinatesRO());
                 }
+
+                RingInfo *rl = new RingInfo();
+                rl->direction = ccw ? COUNTERCLOCKWISE : CLOCKWISE;
+                rl->polygon = Osmium::geos_factory()->createPolygon(lr, NULL);
+                return rl;
+            }
+            catch (const geos::util::GEOSException& exc) 
+            {
+                STOP_TIMER(mor_polygonizer);
+                if (debug)
+                    std::cerr << "Exception: " << exc.what() << std::endl;
                 return NULL;
             }
+        }
 
-            // try extending our current line at the rear end
-            // since we are looking for a LOOP, no sense to try extending it at both ends 
-            // as we'll eventually get there anyway!
-
+        /**
+        * Tries to collect 1...n ways from the n ways in the given list so that
+        * they form a closed ring. If this is possible, flag those as being used
+        * by ring #ringcount in the way list and return the geometry. (The method
+        * may be called again to find further rings.) If this is not possible, 
+        * return NULL.
+        *
+        * The ring is started with the first unused way and extended at its
+        * end with ways sharing the end node (found through the way_ends
+        * index) until it is closed. If we get stuck we go back and try the
+        * next way at that node.
+        */
+        RingInfo *MultipolygonFromRelation::make_one_ring(std::vector<WayInfo *> &ways, const WayEndIndex &way_ends, int ringcount)
+        {
+            int start = -1;
             for (unsigned int i=0; i<ways.size(); i++)
             {
-                if (ways[i]->used < 0) ways[i]->tried = false;
+                if (ways[i]->used == -1)
+                {
+                    start = i;
+                    break;
+                }
             }
+            if (start < 0) return NULL;
 
-            for (unsigned int i=0; i<ways.size(); i++)
+            const osm_object_id_t first = ways[start]->firstnode;
+            ways[start]->used = ringcount;
+            ways[start]->sequence = 0;
+            ways[start]->invert = false;
+
+            std::vector<int> sequence(1, start); // ways in the ring so far
+            std::vector<int> old_used(1, -1);    // their used flags before they were added
+            std::vector<int> next_end(1, first == ways[start]->lastnode ? -1 : way_ends.first(ways[start]->lastnode));
+
+            if (first == ways[start]->lastnode)
             {
-                // ignore used ways
-                if (ways[i]->used >= 0) continue;
-                if (ways[i]->tried) continue;
-                ways[i]->tried = true;
-
-                int old_used = ways[i]->used;
-                if (ways[i]->firstnode == last)
-                {
-                    // add way to end
-                    ways[i]->used = ringcount;
-                    ways[i]->sequence = sequence;
-                    ways[i]->invert = false;
-                    RingInfo *result = make_one_ring(ways, first, ways[i]->lastnode, ringcount, sequence+1);
-                    if (result) { result->ways.push_back(ways[i]); return result; }
-                    ways[i]->used = old_used;
-                }
-                else if (ways[i]->lastnode == last)
-                {
-                    // add way to end, but turn it around
-                    ways[i]->used = ringcount;
-                    ways[i]->sequence = sequence;
-                    ways[i]->invert = true;
-                    RingInfo *result = make_one_ring(ways, first, ways[i]->firstnode, ringcount, sequence+1);
-                    if (result) { result->ways.push_back(ways[i]); return result; }
-                    ways[i]->used = old_used;
-                }
-            }
-            // we have exhausted all combinations.
+                RingInfo *rl = make_ring_from_ways(ways, sequence);
+                if (rl)
+                {
+                    rl->ways.push_back(ways[start]);
+                    return rl;
+                }
+            }
+
+            while (!sequence.empty())
+            {
+                // find next way we haven't tried that can be added at the end
+                int &end = next_end.back();
+                while (end >= 0 && (ways[end / 2]->used >= 0 || ((end & 1) && ways[end / 2]->firstnode == ways[end / 2]->lastnode)))
+                {
+                    end = way_ends.next(end);
+                }
+
+                if (end < 0)
+                {
+                    // we have exhausted all combinations at this end, go back one way
+                    WayInfo *wi = ways[sequence.back()];
+                    wi->used = old_used.back();
+                    sequence.pop_back();
+                    old_used.pop_back();
+                    next_end.pop_back();
+                    continue;
+                }
+
+                const int w = end / 2;
+                const bool invert = end & 1; // way is added at its last node, so turn it around
+                end = way_ends.next(end);
+
+                WayInfo *wi = ways[w];
+
+                old_used.push_back(wi->used);
+                wi->used = ringcount;
+                wi->sequence = sequence.size();
+                wi->invert = invert;
+                sequence.push_back(w);
+
+                const osm_object_id_t last = invert ? wi->firstnode : wi->lastnode;
+                if (last == first)
+                {
+                    // we have found a loop
+                    RingInfo *rl = make_ring_from_ways(ways, sequence);
+                    if (rl)
+                    {
+                        for (std::vector<int>::const_reverse_iterator it = sequence.rbegin(); it != sequence.rend(); it++)
+                        {
+                            rl->ways.push_back(ways[*it]);
+                        }
+                        return rl;
+                    }
+                    next_end.push_back(-1); // go back on next iteration
+                }
+                else
+                {
+                    next_end.push_back(way_ends.first(last));
+                }
+            }
+
+            ways[start]->used = -2;
             return NULL;
         }
 
@@ -409,12 +578,9 @@ namespace Osmium {
                     node2 = dangling_node_map[mindist_id];
                     dangling_node_map[mindist_id] = NULL;
 
-                    std::vector<geos::geom::Coordinate> *c = new std::vector<geos::geom::Coordinate>;
-                    c->push_back(*(node1->getCoordinate()));
-                    c->push_back(*(node2->getCoordinate()));
-                    geos::geom::CoordinateSequence *cs = Osmium::geos_factory()->getCoordinateSequenceFactory()->create(c);
-                    geos::geom::Geometry *geometry = (geos::geom::Geometry *) Osmium::geos_factory()->createLineString(cs);
-                    ways->push_back(new WayInfo(geometry, node1_id, mindist_id, UNSET));
+                    ways->push_back(new WayInfo(*(node1->getCoordinate()), *(node2->getCoordinate()), node1_id, mindist_id, UNSET));
+                    delete node1;
+                    delete node2;
                     if (debug) 
                         std::cerr << "fill gap between nodes " << node1_id << " and " << mindist_id << std::endl;
                 }
@@ -437,30 +603,28 @@ namespace Osmium {
             std::vector<WayInfo *> ways;
 
             // the timestamp of the multipolygon will be the maximum of the timestamp from the relation and from all member ways
-            time_t timestamp = relation->get_timestamp();
+            time_t max_timestamp = relation->get_timestamp();
 
             // assemble all ways which are members of this relation into a 
             // vector of WayInfo elements. this holds room for the way pointer
             // and some extra flags.
             
             START_TIMER(assemble_ways);
-            for (std::vector<Way>::iterator i = member_ways.begin(); i != member_ways.end(); i++) 
+            for (std::vector<MemberWay *>::const_iterator i = member_ways.begin(); i != member_ways.end(); i++) 
             {
-                if (i->get_timestamp() > timestamp) timestamp = i->get_timestamp();
-                WayInfo *wi = new WayInfo(&(*i), UNSET);
-                if (wi->way_geom) 
-                {
-                    geos::io::WKTWriter wkt;
-                } 
-                else 
+                if ((*i)->timestamp > max_timestamp) max_timestamp = (*i)->timestamp;
+                WayInfo *wi = new WayInfo(*i, UNSET);
+                if (!wi->has_geometry()) 
                 {
                     delete wi;
+                    STOP_TIMER(assemble_ways);
                     return geometry_error("invalid way geometry in multipolygon relation member");
                 }
                 ways.push_back(wi);
                 // TODO drop duplicate ways automatically in repair mode?
                 // TODO maybe add INNER/OUTER instead of UNSET to enable later warnings on role mismatch
             }
+            set_timestamp(max_timestamp);
             STOP_TIMER(assemble_ways);
 
             std::vector<RingInfo *> ringlist;
@@ -475,10 +639,13 @@ namespace Osmium {
             // of ways. make_one_ring will automatically flag those that have been
             // used so they are not used again.
             
+            WayEndIndex way_ends;
+            way_ends.build(ways);
+
             do 
             {
                 START_TIMER(make_one_ring);
-                RingInfo *r = make_one_ring(ways, 0, 0, ringlist.size(), 0);
+                RingInfo *r = make_one_ring(ways, way_ends, ringlist.size());
                 STOP_TIMER(make_one_ring);
                 if (r == NULL) break;
                 r->ring_id = ringlist.size();
@@ -500,10 +667,11 @@ namespace Osmium {
 
             // re-run ring building, taking into account the newly created "repair" bits.
             // (in case there were no dangling bits, make_one_ring terminates quickly.)
+            way_ends.build(ways);
             do 
             {
                 START_TIMER(make_one_ring);
-                RingInfo *r = make_one_ring(ways, 0, 0, ringlist.size(), 0);
+                RingInfo *r = make_one_ring(ways, way_ends, ringlist.size());
                 STOP_TIMER(make_one_ring);
                 if (r == NULL) break;
                 r->ring_id = ringlist.size();
@@ -511,6 +679,8 @@ namespace Osmium {
             } 
             while(1);
 
+            if (stats) stats->rings = ringlist.size();
+
             if (ringlist.empty())
             {
                 clear_ringlist();
@@ -528,84 +698,105 @@ namespace Osmium {
 
             START_TIMER(contains);
 
-            bool **contains = new bool*[ringlist.size()];
-            bool *contained_by_even_number = new bool[ringlist.size()];
+            // For every ring, containers[j] lists the rings that contain
+            // ring j, sorted by ring_id. A ring can only contain another
+            // ring if its envelope covers the envelope of the other ring.
+            // The envelopes are put into an STRtree, so we only need to
+            // run the expensive GEOS contains() on these candidates and
+            // not on all pairs of rings.
+
+            std::vector< std::vector<int> > containers(ringlist.size());
 
-            // reset array
+            geos::index::strtree::STRtree ring_tree;
             for (unsigned int i=0; i<ringlist.size(); i++)
             {
-                contains[i] = new bool[ringlist.size()];
-                contained_by_even_number[i] = true;
-                for (unsigned int j=0; j<ringlist.size(); j++)
-                {
-                    contains[i][j] = false;
-                }
+                ring_tree.insert(ringlist[i]->polygon->getEnvelopeInternal(), ringlist[i]);
             }
 
-            // build contains relationships.
-            // we use contained_by_even_number as a helper for us to determine
-            // whether something is an inner (false) or outer (true) ring.
-
-            for (unsigned int i=0; i<ringlist.size(); i++)
+            std::vector<void *> candidates;
+            for (unsigned int j=0; j<ringlist.size(); j++)
             {
-                for (unsigned int j=0; j<ringlist.size(); j++)
+                const geos::geom::Envelope *envelope_j = ringlist[j]->polygon->getEnvelopeInternal();
+
+                candidates.clear();
+                ring_tree.query(envelope_j, candidates);
+
+                for (std::vector<void *>::const_iterator c = candidates.begin(); c != candidates.end(); c++)
                 {
-                    if (i==j) continue;
-                    if (contains[j][i]) continue;
-                    contains[i][j] = ringlist[i]->polygon->contains(ringlist[j]->polygon);
-                    contained_by_even_number[j] ^= contains[i][j];
+                    const RingInfo *candidate = (const RingInfo *) *c;
+                    const int i = candidate->ring_id;
+                    if (i == (int) j) continue;
+
+                    const geos::geom::Envelope *envelope_i = candidate->polygon->getEnvelopeInternal();
+                    if (!envelope_i->covers(envelope_j)) continue;
+
+                    // two rings with the same shape contain each other, in
+                    // that case only the one with the smaller id is the container
+                    if (i > (int) j && envelope_i->equals(envelope_j))
+                    {
+                        COUNT_GEOS_OP();
+                        if (ringlist[j]->polygon->contains(candidate->polygon)) continue;
+                    }
+
+                    COUNT_GEOS_OP();
+                    if (candidate->polygon->contains(ringlist[j]->polygon))
+                    {
+                        containers[j].push_back(i);
+                    }
                 }
+                std::sort(containers[j].begin(), containers[j].end());
             }
 
-            // we now have an array that has a true value whenever something is 
-            // contained by something else; if a contains b and b contains c, then
-            // our array says that a contains b, b contains c, and a contains c.
-            // thin out the array so that only direct relationships remain (and
-            // the "a contains c" is dropped).
+            // containers has an entry whenever something is contained by
+            // something else; if a contains b and b contains c, then c is
+            // contained in a and b. only the direct relationships are of
+            // interest (b contains c), a is a direct container of c only if
+            // none of the other containers of c is contained in a.
+            //
+            // a ring contained by an even number of rings is an outer ring,
+            // otherwise it is an inner ring.
 
-            for (unsigned int i=0; i<ringlist.size(); i++)
+            std::vector< std::pair<int, int> > direct; // (container, contained)
+
+            for (unsigned int j=0; j<ringlist.size(); j++)
             {
-                for (unsigned j=0; j<ringlist.size(); j++)
+                for (std::vector<int>::const_iterator i = containers[j].begin(); i != containers[j].end(); i++)
                 {
-                    if (contains[i][j]) 
+                    bool intermediary = false;
+                    for (std::vector<int>::const_iterator k = containers[j].begin(); k != containers[j].end(); k++)
                     {
-                        // see if there is an intermediary relationship
-                        for (unsigned int k=0; k<ringlist.size(); k++)
+                        if (k == i) continue;
+                        if (std::binary_search(containers[*k].begin(), containers[*k].end(), *i))
                         {
-                            if (k==i) continue;
-                            if (k==j) continue;
-                            if (contains[i][k] && contains[k][j])
-                            {
-                                // intermediary relationship exists; break this
-                                // one up.
-                                contains[i][j] = false;
-                                ringlist[j]->nested = true;
-                                break;
-                            }
+                            intermediary = true;
+                            break;
                         }
                     }
+                    if (intermediary)
+                    {
+                        ringlist[j]->nested = true;
+                    }
+                    else
+                    {
+                        direct.push_back(std::make_pair(*i, (int) j));
+                    }
                 }
             }
 
             // populate the "inner_rings" list and the "contained_by" pointer
-            // in the ring list based on the data collected. the "contains"
-            // array can be thrown away afterwards.
+            // in the ring list based on the data collected.
 
-            for (unsigned int i=0; i<ringlist.size(); i++)
+            std::sort(direct.begin(), direct.end());
+            for (std::vector< std::pair<int, int> >::const_iterator d = direct.begin(); d != direct.end(); d++)
             {
-                for (unsigned int j=0; j<ringlist.size(); j++)
+                const bool contained_by_even_number = (containers[d->second].size() % 2 == 0);
+                if (!contained_by_even_number)
                 {
-                    if (contains[i][j] && !contained_by_even_number[j])
-                    {
-                        ringlist[j]->contained_by = ringlist[i];
-                        ringlist[i]->inner_rings.push_back(ringlist[j]);
-                    }
+                    ringlist[d->second]->contained_by = ringlist[d->first];
+                    ringlist[d->first]->inner_rings.push_back(ringlist[d->second]);
                 }
-                delete[] contains[i];
             }
 
-            delete[] contains;
-            delete[] contained_by_even_number;
             STOP_TIMER(contains);
 
             // now look at all enclosed (inner) rings that consist of only one way.
@@ -650,10 +841,8 @@ namespace Osmium {
                         }
                         else
                         {
-                            Osmium::OSM::MultipolygonFromWay *internal_mp =
-                                new Osmium::OSM::MultipolygonFromWay(ringlist[i]->ways[0]->way, special_mp);
-                            callback(internal_mp);
-                            delete internal_mp;
+                            // handed to the callback (and deleted) in handle_complete_multipolygon()
+                            extra_polygons.push_back(new Osmium::OSM::MultipolygonFromWay(ringlist[i]->ways[0]->way, special_mp));
                             // MultipolygonFromWay destructor deletes the
                             // geometry, so avoid to delete it again.
                             special_mp = NULL;
@@ -666,7 +855,7 @@ namespace Osmium {
 
             // for all non-enclosed rings, assemble holes and build polygon.
 
-            START_TIMER(polygon_build)
+            START_TIMER(polygon_build);
             for (unsigned int i=0; i<ringlist.size(); i++)
             {
                 // look only at outer, i.e. non-contained rings. each ends up as one polygon.
@@ -675,7 +864,7 @@ namespace Osmium {
 
                 std::vector<geos::geom::Geometry *> *holes = new std::vector<geos::geom::Geometry *>(); // ownership is later transferred to polygon
 
-                START_TIMER(inner_ring_touch)
+                START_TIMER(inner_ring_touch);
                 for (int j=0; j<((int)ringlist[i]->inner_rings.size()-1); j++)
                 {
                     if (!ringlist[i]->inner_rings[j]->polygon) continue;
@@ -690,7 +879,9 @@ namespace Osmium {
                         geos::geom::Geometry *inter = NULL;
                         try 
                         {
+                            COUNT_GEOS_OP();
                             if (!ring->intersects(compare)) continue;
+                            COUNT_GEOS_OP();
                             inter = ring->intersection(compare);
                         }
                         catch (const geos::util::GEOSException& exc) 
@@ -702,6 +893,7 @@ namespace Osmium {
                             // touching inner rings
                             // this is allowed, but we must fix them up into a valid
                             // geometry
+                            COUNT_GEOS_OP();
                             geos::geom::Geometry *diff = ring->symDifference(compare);
                             geos::operation::polygonize::Polygonizer *p = new geos::operation::polygonize::Polygonizer();
                             p->add(diff);
@@ -723,7 +915,7 @@ namespace Osmium {
                         }
                     }
                 }
-                STOP_TIMER(inner_ring_touch)
+                STOP_TIMER(inner_ring_touch);
 
                 for (unsigned int j=0; j<ringlist[i]->inner_rings.size(); j++)
                 {
@@ -765,6 +957,7 @@ namespace Osmium {
                 try
                 {
                     p = Osmium::geos_factory()->createPolygon(ring, holes);
+                    COUNT_GEOS_OP();
                     if (p) valid = p->isValid();
                 }
                 catch (const geos::util::GEOSException& exc) 
@@ -779,6 +972,7 @@ namespace Osmium {
                     clear_ringlist();
                     clear_wayinfo();
                     if (p) delete p; else delete ring;
+                    STOP_TIMER(polygon_build);
                     return geometry_error("invalid ring");
                 }
                 else
@@ -831,6 +1025,7 @@ namespace Osmium {
             try
             {
                 mp = Osmium::geos_factory()->createMultiPolygon(polygons);
+                COUNT_GEOS_OP();
                 valid = mp->isValid();
             }
             catch (const geos::util::GEOSException& exc)
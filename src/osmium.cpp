@@ -9,12 +9,8 @@
 
 namespace Osmium {
     geos::geom::GeometryFactory *geos_factory() {
-        static geos::geom::GeometryFactory *global_geometry_factory;
-
-        if (! global_geometry_factory) {
-            geos::geom::PrecisionModel *pm = new geos::geom::PrecisionModel();
-            global_geometry_factory = new geos::geom::GeometryFactory(pm, -1);
-        }
+        // thread safe initialization, multipolygons are built in worker threads
+        static geos::geom::GeometryFactory *global_geometry_factory = new geos::geom::GeometryFactory(new geos::geom::PrecisionModel(), -1);
 
         return global_geometry_factory;
     }
@@ -22,10 +18,23 @@ namespace Osmium {
 
 #endif
 
+namespace Osmium {
+    StringStore *string_pool() {
+        // initialization of a local static is thread safe in C++0x,
+        // so the pool can be used from several threads right away
+        static StringStore *global_string_pool = new StringStore(1024 * 1024);
+
+        return global_string_pool;
+    }
+} // namespace Osmium
+
 // static buffers
 char Osmium::OSM::Node::lon_str[];
 char Osmium::OSM::Node::lat_str[];
 
+// used as a value in PBFParser, so it needs a definition
+const StringStore::string_id_t Osmium::PBFParser::NOT_INTERNED;
+
 // needed for writing WKB (see wkb.hpp)
 extern const char lookup_hex[] = "0123456789abcdef";
 
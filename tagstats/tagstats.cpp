@@ -1,14 +1,19 @@
 
+#include <getopt.h>
+#include <thread>
+
 #include <osmium.hpp>
 
 Osmium::Handler::Statistics      *osmium_handler_stats;
 Osmium::Handler::TagStats        *osmium_handler_tagstats;
-//Osmium::Handler::NLS_Sparsetable *osmium_handler_node_location_store;
+Osmium::Handler::NodeLocationStore *osmium_handler_node_location_store = NULL; // only used with --location-store
 
 void init_handler() {
     // osmium_handler_stats->callback_init();
     osmium_handler_tagstats->callback_init();
-    // osmium_handler_node_location_store->callback_init();
+    if (osmium_handler_node_location_store) {
+        osmium_handler_node_location_store->callback_init();
+    }
 }
 
 void before_nodes_handler() {
@@ -19,10 +24,15 @@ void node_handler(Osmium::OSM::Node *node) {
     osmium_handler_stats->callback_object(node);
     osmium_handler_tagstats->callback_object(node);
     osmium_handler_stats->callback_node(node);
-//    osmium_handler_node_location_store->callback_node(node);
+    if (osmium_handler_node_location_store) {
+        osmium_handler_node_location_store->callback_node(node);
+    }
 }
 
 void after_nodes_handler() {
+    if (osmium_handler_node_location_store) {
+        osmium_handler_node_location_store->callback_after_nodes();
+    }
     osmium_handler_tagstats->callback_after_nodes();
 }
 
@@ -31,10 +41,12 @@ void before_ways_handler() {
 }
 
 void way_handler(Osmium::OSM::Way *way) {
+    if (osmium_handler_node_location_store) {
+        osmium_handler_node_location_store->callback_way(way);
+    }
     osmium_handler_stats->callback_object(way);
     osmium_handler_tagstats->callback_object(way);
     osmium_handler_stats->callback_way(way);
-//    osmium_handler_node_location_store->callback_way(way);
 }
 
 void after_ways_handler() {
@@ -56,7 +68,9 @@ void after_relations_handler() {
 }
 
 void final_handler() {
-    // osmium_handler_node_location_store->callback_final();
+    if (osmium_handler_node_location_store) {
+        osmium_handler_node_location_store->callback_final();
+    }
     osmium_handler_stats->callback_final();
     osmium_handler_tagstats->callback_final();
 }
@@ -82,21 +96,83 @@ struct callbacks *setup_callbacks() {
 
 int main(int argc, char *argv[]) {
     bool debug = false; // XXX set this from command line
+    int num_threads = std::thread::hardware_concurrency();
+    int users_precision = 0;
+    size_t max_keypairs = 0;
+    bool separate_table_dbs = false;
+    enum location_store_t {
+        NONE,
+        ARRAY,
+        DISK,
+        SPARSETABLE
+    } location_store = NONE;
+
+    static struct option long_options[] = {
+        {"threads",            required_argument, 0, 't'},
+        {"users-precision",    required_argument, 0, 'u'},
+        {"location-store",     required_argument, 0, 'l'},
+        {"max-keypairs",       required_argument, 0, 'k'},
+        {"separate-table-dbs", no_argument,       0, 's'},
+        {0, 0, 0, 0}
+    };
+
+    while (1) {
+        int c = getopt_long(argc, argv, "t:u:l:k:s", long_options, 0);
+        if (c == -1)
+            break;
+
+        switch (c) {
+            case 't':
+                num_threads = atoi(optarg);
+                break;
+            case 'u':
+                users_precision = atoi(optarg);
+                break;
+            case 'k':
+                max_keypairs = atol(optarg);
+                break;
+            case 's':
+                separate_table_dbs = true;
+                break;
+            case 'l':
+                if (!strcmp(optarg, "array")) {
+                    location_store = ARRAY;
+                } else if (!strcmp(optarg, "disk")) {
+                    location_store = DISK;
+                } else if (!strcmp(optarg, "sparsetable")) {
+                    location_store = SPARSETABLE;
+                } else {
+                    std::cerr << "Unknown location store: " << optarg << " (available are: 'array', 'disk' and 'sparsetable')" << std::endl;
+                    exit(1);
+                }
+                break;
+            default:
+                exit(1);
+        }
+    }
 
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " OSMFILE" << std::endl;
+    if (optind != argc-1) {
+        std::cerr << "Usage: " << argv[0] << " [--threads=N] [--users-precision=P] [--location-store=STORE] [--max-keypairs=N] [--separate-table-dbs] OSMFILE" << std::endl;
         exit(1);
     }
 
     osmium_handler_stats               = new Osmium::Handler::Statistics(debug);
-    osmium_handler_tagstats            = new Osmium::Handler::TagStats(debug);
-//    osmium_handler_node_location_store = new Osmium::Handler::NLS_Sparsetable(debug);
+    osmium_handler_tagstats            = new Osmium::Handler::TagStats(debug, num_threads, users_precision, location_store != NONE, max_keypairs, separate_table_dbs);
+
+    // with a location store the locations of ways are added to the location images
+    if (location_store == ARRAY) {
+        osmium_handler_node_location_store = new Osmium::Handler::NLS_Array(debug);
+    } else if (location_store == DISK) {
+        osmium_handler_node_location_store = new Osmium::Handler::NLS_Disk(debug);
+    } else if (location_store == SPARSETABLE) {
+        osmium_handler_node_location_store = new Osmium::Handler::NLS_Sparsetable(debug);
+    }
 
     Osmium::OSM::Node     *node     = new Osmium::OSM::Node;
     Osmium::OSM::Way      *way      = new Osmium::OSM::Way;
     Osmium::OSM::Relation *relation = new Osmium::OSM::Relation;
 
-    parse_osmfile(false, argv[1], setup_callbacks(), node, way, relation);
+    parse_osmfile(false, argv[optind], setup_callbacks(), node, way, relation);
 
     return 0;
 }
@@ -0,0 +1,345 @@
+/*
+
+  Round trip check of Osmium::Handler::Extract: Generated data is
+  written as XML and PBF, extracts of a polygon with a hole and of a
+  bounding box are cut from both (with and without complete ways) and
+  what is read back from the extracts is compared with the objects that
+  should be in them.
+
+*/
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include <osmium.hpp>
+#include <HandlerExtract.hpp>
+
+const int num_nodes     = 20000;
+const int num_ways      = 2000;
+const int num_relations = 300;
+
+struct TestNode {
+    double lon;
+    double lat;
+};
+
+struct TestMember {
+    char type;
+    osm_object_id_t ref;
+};
+
+// the test data, the index is the id (there is no object with id 0)
+std::vector<TestNode> nodes;
+std::vector<std::vector<osm_object_id_t> > ways;
+std::vector<std::vector<TestMember> > relations;
+
+/// the tag of an object, every third object has one
+std::string tag_value(char type, osm_object_id_t id) {
+    std::ostringstream value;
+    value << type << "-" << id;
+    return id % 3 ? "" : value.str();
+}
+
+void generate_data() {
+    srand(47);
+    nodes.resize(num_nodes + 1);
+    for (int i=1; i <= num_nodes; i++) {
+        // never exactly on the borders of the regions
+        nodes[i].lon = (rand() % 3000) / 100.0 - 25 + 0.005;
+        nodes[i].lat = (rand() % 8000) / 100.0 - 20 + 0.005;
+    }
+    ways.resize(num_ways + 1);
+    for (int i=1; i <= num_ways; i++) {
+        const osm_object_id_t first = 1 + rand() % (num_nodes - 1000);
+        for (int j=0; j < 5; j++) {
+            ways[i].push_back(first + rand() % 1000);
+        }
+    }
+    relations.resize(num_relations + 1);
+    for (int i=1; i <= num_relations; i++) {
+        for (int j=0; j < 2; j++) {
+            TestMember member;
+            switch (rand() % 3) {
+                case 0:
+                    member.type = 'n';
+                    member.ref = 1 + rand() % num_nodes;
+                    break;
+                case 1:
+                    member.type = 'w';
+                    member.ref = 1 + rand() % num_ways;
+                    break;
+                default: // only relations seen before can be in an extract
+                    member.type = 'r';
+                    member.ref = 1 + rand() % i;
+                    break;
+            }
+            relations[i].push_back(member);
+        }
+    }
+}
+
+template <class T>
+void write_data(const char *filename) {
+    static Osmium::OSM::Node node;
+    static Osmium::OSM::Way way;
+    static Osmium::OSM::Relation relation;
+    char id[32];
+
+    T output(false, filename);
+    output.callback_init();
+    for (int i=1; i <= num_nodes; i++) {
+        node.reset();
+        sprintf(id, "%d", i);
+        node.set_attribute("id", id);
+        node.set_attribute("version", "1");
+        node.set_coordinates(nodes[i].lon, nodes[i].lat);
+        if (!tag_value('n', i).empty()) {
+            node.add_tag("test", tag_value('n', i).c_str());
+        }
+        output.callback_node(&node);
+    }
+    for (int i=1; i <= num_ways; i++) {
+        way.reset();
+        sprintf(id, "%d", i);
+        way.set_attribute("id", id);
+        way.set_attribute("version", "1");
+        for (unsigned int j=0; j < ways[i].size(); j++) {
+            way.add_node(ways[i][j]);
+        }
+        if (!tag_value('w', i).empty()) {
+            way.add_tag("test", tag_value('w', i).c_str());
+        }
+        output.callback_way(&way);
+    }
+    for (int i=1; i <= num_relations; i++) {
+        relation.reset();
+        sprintf(id, "%d", i);
+        relation.set_attribute("id", id);
+        relation.set_attribute("version", "1");
+        for (unsigned int j=0; j < relations[i].size(); j++) {
+            relation.add_member(relations[i][j].type, relations[i][j].ref, "");
+        }
+        if (!tag_value('r', i).empty()) {
+            relation.add_tag("test", tag_value('r', i).c_str());
+        }
+        output.callback_relation(&relation);
+    }
+    output.callback_final();
+}
+
+/*
+  Objects are compared as strings with their id, way nodes or relation
+  members and tags. Node locations are checked against the test data
+  while reading.
+*/
+
+std::string describe(char type, osm_object_id_t id, const std::string &refs, const std::string &tag) {
+    std::ostringstream s;
+    s << type << id << " [" << refs << "] " << tag;
+    return s.str();
+}
+
+std::string way_refs(const std::vector<osm_object_id_t> &way_nodes) {
+    std::ostringstream s;
+    for (unsigned int i=0; i < way_nodes.size(); i++) {
+        s << way_nodes[i] << " ";
+    }
+    return s.str();
+}
+
+std::string relation_refs(const std::vector<TestMember> &members) {
+    std::ostringstream s;
+    for (unsigned int i=0; i < members.size(); i++) {
+        s << members[i].type << members[i].ref << " ";
+    }
+    return s.str();
+}
+
+std::set<std::string> objects_read;
+int locations_wrong;
+
+const char *tag_of(Osmium::OSM::Object *object) {
+    const char *value = object->get_tag_by_key("test");
+    return value ? value : "";
+}
+
+void read_node(Osmium::OSM::Node *node) {
+    const osm_object_id_t id = node->get_id();
+    if (std::fabs(node->get_lon() - nodes[id].lon) > 1e-6 || std::fabs(node->get_lat() - nodes[id].lat) > 1e-6) {
+        locations_wrong++;
+    }
+    objects_read.insert(describe('n', id, "", tag_of(node)));
+}
+
+void read_way(Osmium::OSM::Way *way) {
+    std::vector<osm_object_id_t> way_nodes(way->nodes, way->nodes + way->node_count());
+    objects_read.insert(describe('w', way->get_id(), way_refs(way_nodes), tag_of(way)));
+}
+
+void read_relation(Osmium::OSM::Relation *relation) {
+    std::vector<TestMember> members;
+    for (osm_sequence_id_t i=0; i < relation->member_count(); i++) {
+        TestMember member;
+        member.type = relation->get_member(i)->type;
+        member.ref  = relation->get_member(i)->ref;
+        members.push_back(member);
+    }
+    objects_read.insert(describe('r', relation->get_id(), relation_refs(members), tag_of(relation)));
+}
+
+std::set<std::string> read_extract(const char *filename) {
+    static struct callbacks cb;
+    cb.node     = read_node;
+    cb.way      = read_way;
+    cb.relation = read_relation;
+
+    static Osmium::OSM::Node node;
+    static Osmium::OSM::Way way;
+    static Osmium::OSM::Relation relation;
+
+    objects_read.clear();
+    locations_wrong = 0;
+    parse_osmfile(false, const_cast<char *>(filename), &cb, &node, &way, &relation);
+    assert(locations_wrong == 0);
+    return objects_read;
+}
+
+/// square from 0/0 to 10/10 with a hole from 4/4 to 6/6
+bool in_polygon(double lon, double lat) {
+    return lon > 0 && lon < 10 && lat > 0 && lat < 10 && !(lon > 4 && lon < 6 && lat > 4 && lat < 6);
+}
+
+bool in_bbox(double lon, double lat) {
+    return lon >= -20 && lon <= -5 && lat >= 30 && lat <= 50;
+}
+
+/// the objects that should be in the extract of the region
+std::set<std::string> expected_objects(bool (*in_region)(double, double), bool complete_ways) {
+    std::vector<bool> node_in(num_nodes + 1, false);
+    std::vector<bool> way_in(num_ways + 1, false);
+    std::vector<bool> relation_in(num_relations + 1, false);
+
+    for (int i=1; i <= num_nodes; i++) {
+        node_in[i] = in_region(nodes[i].lon, nodes[i].lat);
+    }
+    for (int i=1; i <= num_ways; i++) {
+        for (unsigned int j=0; j < ways[i].size(); j++) {
+            if (in_region(nodes[ways[i][j]].lon, nodes[ways[i][j]].lat)) {
+                way_in[i] = true;
+            }
+        }
+        if (way_in[i] && complete_ways) {
+            for (unsigned int j=0; j < ways[i].size(); j++) {
+                node_in[ways[i][j]] = true;
+            }
+        }
+    }
+    for (int i=1; i <= num_relations; i++) {
+        for (unsigned int j=0; j < relations[i].size(); j++) {
+            const TestMember &m = relations[i][j];
+            if ((m.type == 'n' && node_in[m.ref]) || (m.type == 'w' && way_in[m.ref]) || (m.type == 'r' && m.ref < i && relation_in[m.ref])) {
+                relation_in[i] = true;
+            }
+        }
+    }
+
+    std::set<std::string> expected;
+    for (int i=1; i <= num_nodes; i++) {
+        if (node_in[i]) {
+            expected.insert(describe('n', i, "", tag_value('n', i)));
+        }
+    }
+    for (int i=1; i <= num_ways; i++) {
+        if (way_in[i]) {
+            expected.insert(describe('w', i, way_refs(ways[i]), tag_value('w', i)));
+        }
+    }
+    for (int i=1; i <= num_relations; i++) {
+        if (relation_in[i]) {
+            expected.insert(describe('r', i, relation_refs(relations[i]), tag_value('r', i)));
+        }
+    }
+    return expected;
+}
+
+Osmium::Handler::Extract *extract;
+
+void extract_init() {
+    extract->callback_init();
+}
+
+void extract_node(Osmium::OSM::Node *node) {
+    extract->callback_node(node);
+}
+
+void extract_way(Osmium::OSM::Way *way) {
+    extract->callback_way(way);
+}
+
+void extract_relation(Osmium::OSM::Relation *relation) {
+    extract->callback_relation(relation);
+}
+
+void extract_final() {
+    extract->callback_final();
+}
+
+void check_extracts(const char *input, bool complete_ways) {
+    static struct callbacks cb;
+    cb.init     = extract_init;
+    cb.node     = extract_node;
+    cb.way      = extract_way;
+    cb.relation = extract_relation;
+    cb.final    = extract_final;
+
+    static Osmium::OSM::Node node;
+    static Osmium::OSM::Way way;
+    static Osmium::OSM::Relation relation;
+
+    extract = new Osmium::Handler::Extract(false, complete_ways);
+    extract->add_extract(new Osmium::Handler::Extract::Polygon("extract-test.poly"), "extract-test-polygon.osm.pbf");
+    extract->add_extract(new Osmium::Handler::Extract::Bbox(-20, 30, -5, 50), "extract-test-bbox.osm");
+    for (int pass=0; pass < extract->passes(); pass++) {
+        parse_osmfile(false, const_cast<char *>(input), &cb, &node, &way, &relation);
+    }
+    delete extract;
+
+    const std::set<std::string> polygon = expected_objects(in_polygon, complete_ways);
+    const std::set<std::string> bbox = expected_objects(in_bbox, complete_ways);
+    assert(polygon.size() > 100 && bbox.size() > 100);
+    assert(read_extract("extract-test-polygon.osm.pbf") == polygon);
+    assert(read_extract("extract-test-bbox.osm") == bbox);
+
+    printf("extract: %s%s: %zu objects in polygon, %zu in bbox: ok\n", input, complete_ways ? " (complete ways)" : "", polygon.size(), bbox.size());
+}
+
+int main() {
+    generate_data();
+    write_data<Osmium::Output::XML>("extract-test-input.osm");
+    write_data<Osmium::Output::PBF>("extract-test-input.osm.pbf");
+
+    FILE *poly = fopen("extract-test.poly", "w");
+    assert(poly);
+    fprintf(poly, "test\n1\n  0 0\n  10 0\n  10 10\n  0 10\n  0 0\nEND\n!2\n  4 4\n  6 4\n  6 6\n  4 6\n  4 4\nEND\nEND\n");
+    fclose(poly);
+
+    check_extracts("extract-test-input.osm", false);
+    check_extracts("extract-test-input.osm", true);
+    check_extracts("extract-test-input.osm.pbf", false);
+    check_extracts("extract-test-input.osm.pbf", true);
+
+    unlink("extract-test-input.osm");
+    unlink("extract-test-input.osm.pbf");
+    unlink("extract-test.poly");
+    unlink("extract-test-polygon.osm.pbf");
+    unlink("extract-test-bbox.osm");
+
+    return 0;
+}
@@ -0,0 +1,48 @@
+/*
+
+  Check that a MultipolygonFromWay reused for several closed ways reports
+  the attributes of the current way, not cached values of an earlier one.
+
+*/
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+#include <osmium.hpp>
+
+static void init_way(Osmium::OSM::Way *way, const char *id, const char *timestamp) {
+    way->reset();
+    way->set_attribute("id", id);
+    way->set_attribute("timestamp", timestamp);
+    for (osm_object_id_t n=1; n <= 4; n++) {
+        way->add_node(n);
+    }
+    way->add_node(1);
+    way->set_node_coordinates(0, 0.0, 0.0);
+    way->set_node_coordinates(1, 1.0, 0.0);
+    way->set_node_coordinates(2, 1.0, 1.0);
+    way->set_node_coordinates(3, 0.0, 1.0);
+    way->set_node_coordinates(4, 0.0, 0.0);
+}
+
+int main() {
+    Osmium::OSM::Way *way = new Osmium::OSM::Way();
+    Osmium::OSM::MultipolygonFromWay *area = new Osmium::OSM::MultipolygonFromWay();
+
+    init_way(way, "17", "2010-01-01T00:00:00Z");
+    area->set_way(way);
+    assert(area->get_id() == 17);
+    assert(!strcmp(area->get_timestamp_str(), "2010-01-01T00:00:00Z"));
+
+    init_way(way, "18", "2011-06-15T12:30:00Z");
+    area->set_way(way);
+    assert(area->get_id() == 18);
+    assert(!strcmp(area->get_timestamp_str(), "2011-06-15T12:30:00Z"));
+
+    delete area;
+    delete way;
+
+    printf("multipolygon_from_way: ok\n");
+    return 0;
+}